@@ -0,0 +1,44 @@
+/*
+ * jobshm.h - Layout of the job status segment that tsh publishes
+ *    (with -m) and tshtop reads
+ *
+ * The segment is a POSIX shared memory object named "/tsh.<pid>".
+ * The shell is the only writer and uses a sequence lock: seq is odd
+ * while a slot is being rewritten and is bumped again when done, so a
+ * reader copies the segment and retries if seq was odd or changed.
+ * Readers never block the shell. The counters are bumped outside the
+ * lock and are only exact once the shell is idle.
+ */
+#ifndef JOBSHM_H
+#define JOBSHM_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#define JOBSHM_NAME "/tsh.%d" /* shm_open name, %d is the shell's PID */
+#define JOBSHM_MAXJOBS 16     /* slots, one per job list entry */
+#define JOBSHM_MAXPROC 16     /* stage PIDs kept per job */
+#define JOBSHM_CMDLEN 128     /* command line bytes kept per job */
+
+struct jobstat_t {             /* One published job */
+  pid_t pid;                   /* job PID, 0 if the slot is free */
+  int jid;                     /* job ID */
+  int state;                   /* UNDEF, FG, BG or ST as in tsh.c */
+  int nproc;                   /* number of stages */
+  pid_t pids[JOBSHM_MAXPROC];  /* stage PIDs, 0 once reaped */
+  struct timespec start;       /* CLOCK_REALTIME when the job started */
+  char cmdline[JOBSHM_CMDLEN]; /* command line, truncated */
+};
+
+struct jobshm_t {                /* The whole segment */
+  unsigned seq;                  /* sequence lock, odd while writing */
+  pid_t shell;                   /* PID of the publishing shell */
+  unsigned long nforked;         /* children forked */
+  unsigned long nreaped;         /* children reaped by waitpid */
+  unsigned long nadded;          /* jobs added to the job list */
+  unsigned long ndeleted;        /* jobs deleted from the job list */
+  unsigned long nstopped;        /* job stops reported */
+  struct jobstat_t jobs[JOBSHM_MAXJOBS];
+};
+
+#endif /* JOBSHM_H */
@@ -0,0 +1,39 @@
+/* 
+ * myburst.c - Spawns a burst of short-lived children
+ * 
+ * usage: myburst <n>
+ * Forks <n> children as fast as it can, each of which exits at once,
+ * then reaps them all. Every process stays in the caller's process
+ * group, so a signal sent to the job reaches the whole burst.
+ *
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+int main(int argc, char **argv) 
+{
+    int i, n;
+    pid_t pid;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s <n>\n", argv[0]);
+	exit(0);
+    }
+    n = atoi(argv[1]);
+
+    for (i=0; i < n; i++) {
+	if ((pid = fork()) == 0) /* child */
+	    _exit(0);
+	if (pid < 0)
+	    break; /* out of processes, reap what we have */
+    }
+
+    /* parent reaps the whole burst */
+    while (wait(NULL) > 0)
+	;
+
+    exit(0);
+}
@@ -0,0 +1,96 @@
+/* 
+ * mychaos.c - Random job control signals for stress testing tsh
+ * 
+ * usage: mychaos <pid> <n> [<usecs>]
+ * Reads the job list published by the tsh with PID <pid> (started
+ * with -m) and sends <n> random SIGTSTP, SIGCONT, SIGINT or SIGKILL
+ * signals, <usecs> microseconds apart (default 1000), to the process
+ * group of a random job or to one of its stages. Prints how many of
+ * each it sent when done.
+ *
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include "jobshm.h"
+
+void snapshot(const struct jobshm_t *shm, struct jobshm_t *copy);
+
+int main(int argc, char **argv) 
+{
+    static const int sigs[] = { SIGTSTP, SIGCONT, SIGCONT, SIGINT, SIGKILL };
+    static const char *names[] = { "stop", "cont", "cont", "int", "kill" };
+    unsigned long sent[5] = { 0 };
+    struct jobshm_t *shm, copy;
+    struct jobstat_t *js;
+    char name[32];
+    int i, j, k, n, fd, usecs, which;
+    pid_t pid, target;
+
+    if (argc < 3) {
+	fprintf(stderr, "Usage: %s <pid> <n> [<usecs>]\n", argv[0]);
+	exit(0);
+    }
+    pid = atoi(argv[1]);
+    n = atoi(argv[2]);
+    usecs = argc > 3 ? atoi(argv[3]) : 1000;
+    srand(getpid());
+
+    sprintf(name, JOBSHM_NAME, pid);
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+	perror(name);
+	exit(1);
+    }
+    shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    close(fd);
+
+    for (i=0; i < n; i++) {
+	usleep(usecs);
+	/* a torn slot could pair one job's pid with another's stages */
+	snapshot(shm, &copy);
+	j = rand() % JOBSHM_MAXJOBS;
+	js = &copy.jobs[j];
+	if (js->pid <= 0 || js->nproc < 1 || js->nproc > JOBSHM_MAXPROC)
+	    continue;
+	target = -js->pid; /* whole job */
+	k = rand() % js->nproc;
+	if (rand() % 4 == 0 && js->pids[k] > 0)
+	    target = js->pids[k]; /* one stage */
+	which = rand() % 5;
+	if (kill(target, sigs[which]) == 0)
+	    sent[which]++;
+    }
+
+    fprintf(stderr, "mychaos: sent");
+    for (i=0; i < 5; i++)
+	if (i != 2)
+	    fprintf(stderr, " %lu %s", sent[i] + (i == 1 ? sent[2] : 0), names[i]);
+    fprintf(stderr, "\n");
+    exit(0);
+}
+
+/*
+ * snapshot - Take a consistent copy of the job status segment
+ */
+void snapshot(const struct jobshm_t *shm, struct jobshm_t *copy)
+{
+    unsigned before, after;
+
+    do {
+	before = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+	if (before & 1)
+	    continue;
+	memcpy(copy, shm, sizeof(*copy));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
@@ -0,0 +1,13 @@
+/* 
+ * myexit.c - A child that is gone as soon as it starts
+ * 
+ * usage: myexit [<status>]
+ * Exits at once with <status> (default 0).
+ *
+ */
+#include <stdlib.h>
+
+int main(int argc, char **argv) 
+{
+    exit(argc > 1 ? atoi(argv[1]) : 0);
+}
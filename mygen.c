@@ -0,0 +1,46 @@
+/* 
+ * mygen.c - Data generator for pipeline throughput tests
+ * 
+ * usage: mygen <n>
+ * Writes <n> bytes (K, M or G suffixes allowed) to stdout in 1 MB
+ * writes and exits.
+ *
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define CHUNK (1 << 20)
+
+static char buf[CHUNK];
+
+int main(int argc, char **argv) 
+{
+    long long left;
+    char *end;
+    ssize_t n;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s <n>\n", argv[0]);
+	exit(0);
+    }
+    left = strtoll(argv[1], &end, 10);
+    switch (toupper(*end)) {
+    case 'G': left <<= 10; /* fall through */
+    case 'M': left <<= 10; /* fall through */
+    case 'K': left <<= 10;
+    }
+    memset(buf, 'x', sizeof(buf));
+
+    while (left > 0) {
+	n = write(STDOUT_FILENO, buf, left < CHUNK ? left : CHUNK);
+	if (n <= 0) {
+	    perror("write");
+	    exit(1);
+	}
+	left -= n;
+    }
+    exit(0);
+}
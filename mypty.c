@@ -0,0 +1,230 @@
+/*
+ * mypty.c - Terminal job control test harness for tsh
+ *
+ * usage: mypty [-s <shell>]
+ * Runs <shell> (default ./tsh) as a session leader on a new pty, so
+ * that it is an interactive job control shell, and types at it: ctrl-c
+ * and ctrl-z for a foreground job, fg of a stopped job, and a job that
+ * changes the terminal modes and stops. Checks which process group
+ * owns the terminal at each step and that each job gets its own modes
+ * back. Prints one line per check and the ctrl-c latency, and exits
+ * nonzero on any failure.
+ */
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define TIMEOUT 3000 /* ms to wait for any one thing */
+
+int master, slave;   /* the pty; we keep the slave to read its modes */
+char out[1 << 16];   /* everything the shell printed */
+int nout, mark;      /* bytes in out, start of the unmatched part */
+int failed = 0;
+
+void type(const char *keys);
+int expect(const char *text, int ms);
+pid_t waitfgpgrp(pid_t not, int ms);
+pid_t fgpgrp(void);
+int echoing(void);
+void check(int ok, const char *what);
+double now(void);
+
+int main(int argc, char **argv)
+{
+    char *shell = "./tsh", *name;
+    pid_t tsh, job;
+    double t;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:")) != EOF) {
+	switch (c) {
+	case 's':
+	    shell = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-s <shell>]\n", argv[0]);
+	    exit(1);
+	}
+    }
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+	grantpt(master) < 0 || unlockpt(master) < 0 ||
+	(name = ptsname(master)) == NULL) {
+	perror("pty");
+	exit(1);
+    }
+    if ((tsh = fork()) == 0) {
+	setsid();
+	if ((slave = open(name, O_RDWR)) < 0 ||
+	    ioctl(slave, TIOCSCTTY, 0) < 0) {
+	    perror(name);
+	    exit(1);
+	}
+	dup2(slave, 0);
+	dup2(slave, 1);
+	dup2(slave, 2);
+	close(slave);
+	close(master);
+	execl(shell, shell, (char *)NULL);
+	perror(shell);
+	exit(1);
+    }
+    if ((slave = open(name, O_RDWR | O_NOCTTY)) < 0) {
+	perror(name);
+	exit(1);
+    }
+
+    check(expect("tsh> ", TIMEOUT), "shell prompts");
+    check(fgpgrp() == tsh, "shell owns the terminal");
+
+    /* ctrl-c goes to the job, not through the shell */
+    type("./myspin 10\n");
+    job = waitfgpgrp(tsh, TIMEOUT);
+    check(job > 0 && job != tsh, "fg job owns the terminal");
+    t = now();
+    type("\003");
+    check(expect("terminated by signal 2", TIMEOUT), "ctrl-c kills the fg job");
+    printf("  ctrl-c to job reaped: %.0f us\n", (now() - t) * 1e6);
+    expect("tsh> ", TIMEOUT);
+    check(fgpgrp() == tsh, "shell has the terminal back");
+
+    /* ctrl-z stops it, fg hands the terminal back to it */
+    type("./myspin 10\n");
+    job = waitfgpgrp(tsh, TIMEOUT);
+    type("\032");
+    check(expect("stopped by signal 20", TIMEOUT), "ctrl-z stops the fg job");
+    expect("tsh> ", TIMEOUT);
+    check(fgpgrp() == tsh, "shell has the terminal back");
+    type("fg %1\n");
+    check(waitfgpgrp(tsh, TIMEOUT) == job, "fg gives the job the terminal");
+    type("\003");
+    check(expect("terminated by signal 2", TIMEOUT), "ctrl-c kills the fg'd job");
+    expect("tsh> ", TIMEOUT);
+
+    /* a job's terminal modes are its own */
+    check(echoing(), "shell modes echo");
+    type("/bin/sh -c 'stty -echo; kill -STOP $$; sleep 1'\n");
+    check(expect("stopped by signal 19", TIMEOUT), "job turns echo off and stops");
+    expect("tsh> ", TIMEOUT);
+    check(echoing(), "shell modes are back while it is stopped");
+    type("fg %1\n");
+    waitfgpgrp(tsh, TIMEOUT);
+    check(!echoing(), "fg restores the job's modes");
+    check(waitfgpgrp(0, TIMEOUT) == tsh, "shell gets the terminal when it exits");
+    check(echoing(), "shell modes are back after it exits");
+
+    type("quit\n");
+    waitpid(tsh, NULL, 0);
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    exit(failed);
+}
+
+/*
+ * type - Send keys to the shell's terminal
+ */
+void type(const char *keys)
+{
+    if (write(master, keys, strlen(keys)) < 0)
+	perror("write");
+}
+
+/*
+ * expect - Read the shell's output until text shows up after the last
+ *    match, for at most ms milliseconds. Returns 1 if it did.
+ */
+int expect(const char *text, int ms)
+{
+    struct pollfd pfd = { master, POLLIN, 0 };
+    double deadline = now() + ms / 1000.0;
+    char *p;
+    int n;
+
+    for (;;) {
+	out[nout] = '\0';
+	if ((p = strstr(out + mark, text)) != NULL) {
+	    mark = p + strlen(text) - out;
+	    return 1;
+	}
+	if (nout == sizeof(out) - 1 || now() > deadline)
+	    return 0;
+	if (poll(&pfd, 1, 10) > 0) {
+	    if ((n = read(master, out + nout, sizeof(out) - 1 - nout)) <= 0)
+		return 0;
+	    nout += n;
+	}
+    }
+}
+
+/*
+ * waitfgpgrp - Wait up to ms milliseconds for the terminal's foreground
+ *    process group to be something other than not (or, if not is 0,
+ *    the shell's, i.e. the one it had before), draining the shell's
+ *    output meanwhile. Returns the group, or -1 on timeout.
+ */
+pid_t waitfgpgrp(pid_t not, int ms)
+{
+    double deadline = now() + ms / 1000.0;
+    pid_t first = fgpgrp(), pgrp;
+
+    while (now() < deadline) {
+	pgrp = fgpgrp();
+	if (not != 0 ? pgrp != not : pgrp != first)
+	    return pgrp;
+	expect("\001", 10); /* never matches, just reads */
+    }
+    return -1;
+}
+
+/*
+ * fgpgrp - The terminal's foreground process group. Asked through the
+ *    master, since the pty is not our controlling terminal.
+ */
+pid_t fgpgrp(void)
+{
+    pid_t pgrp;
+
+    if (ioctl(master, TIOCGPGRP, &pgrp) < 0)
+	return -1;
+    return pgrp;
+}
+
+/*
+ * echoing - Is echo on in the terminal's current modes?
+ */
+int echoing(void)
+{
+    struct termios tm;
+
+    tcgetattr(slave, &tm);
+    return (tm.c_lflag & ECHO) != 0;
+}
+
+/*
+ * check - Report one check
+ */
+void check(int ok, const char *what)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    failed |= !ok;
+}
+
+/*
+ * now - Seconds on the monotonic clock
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,43 @@
+/* 
+ * mysink.c - Data sink for pipeline throughput tests
+ * 
+ * usage: mysink
+ * Reads stdin to EOF in 1 MB reads, then reports on stderr how many
+ * bytes arrived and the rate from the first byte to EOF in GB/s.
+ *
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHUNK (1 << 20)
+
+static char buf[CHUNK];
+
+int main(int argc, char **argv) 
+{
+    long long total = 0;
+    struct timespec start, stop;
+    double secs;
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, buf, CHUNK)) > 0) {
+	if (total == 0)
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	total += n;
+    }
+    if (n < 0) {
+	perror("read");
+	exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (total == 0)
+	secs = 0;
+    else
+	secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "mysink: %lld bytes in %.3f s, %.2f GB/s\n", total, secs,
+	    secs > 0 ? total / secs / 1e9 : 0.0);
+    exit(0);
+}
@@ -0,0 +1,314 @@
+/*
+ * mystress.c - SIGCHLD storm stress harness for tsh
+ *
+ * usage: mystress [-n <lines>] [-c <signals>] [-s <shell>]
+ * Runs <shell> -p -m (default ./tsh) and feeds it <lines> (default
+ * 2000) random command lines built from myexit, myburst and short
+ * pipelines, mixed with bg, fg, wait -n and jobs, while mychaos
+ * sends it <signals> (default 2000) random job control signals.
+ * The job list published by the shell is checked for corruption
+ * throughout. At the end every job is continued and the shell is
+ * left to drain; then there must be no jobs left, no zombie children,
+ * and as many reaps as forks. Prints the counters and exits nonzero
+ * on any failure.
+ *
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "jobshm.h"
+
+#define OUTFILE "mystress.out" /* everything the shell printed */
+
+void snapshot(const struct jobshm_t *shm, struct jobshm_t *copy);
+int checkjobs(const struct jobshm_t *copy);
+int zombies(pid_t ppid);
+int countlines(const char *file, const char *text);
+
+int main(int argc, char **argv)
+{
+    char *shell = "./tsh", line[256], name[32], arg[32];
+    int lines = 2000, nsigs = 2000;
+    int c, i, k, fd, njobs, corrupt = 0, nzombies, failed = 0;
+    int in[2];
+    pid_t tsh, chaos;
+    struct jobshm_t *shm = NULL, copy;
+    FILE *to;
+    time_t deadline;
+
+    while ((c = getopt(argc, argv, "n:c:s:")) != EOF) {
+	switch (c) {
+	case 'n':
+	    lines = atoi(optarg);
+	    break;
+	case 'c':
+	    nsigs = atoi(optarg);
+	    break;
+	case 's':
+	    shell = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-n <lines>] [-c <signals>] [-s <shell>]\n", argv[0]);
+	    exit(1);
+	}
+    }
+    srand(getpid());
+    signal(SIGPIPE, SIG_IGN);
+
+    /* start the shell with its output going to OUTFILE */
+    if (pipe(in) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    if ((tsh = fork()) == 0) {
+	dup2(in[0], 0);
+	close(in[0]);
+	close(in[1]);
+	if ((fd = open(OUTFILE, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+	    perror(OUTFILE);
+	    exit(1);
+	}
+	dup2(fd, 1);
+	close(fd);
+	execl(shell, shell, "-p", "-m", (char *)NULL);
+	perror(shell);
+	exit(1);
+    }
+    close(in[0]);
+    to = fdopen(in[1], "w");
+    setvbuf(to, NULL, _IOLBF, 0);
+
+    /* wait for the job status segment to show up */
+    sprintf(name, JOBSHM_NAME, tsh);
+    for (i=0; i < 1000 && shm == NULL; i++) {
+	if ((fd = shm_open(name, O_RDONLY, 0)) >= 0) {
+	    shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	    close(fd);
+	    if (shm == MAP_FAILED)
+		shm = NULL;
+	}
+	if (shm == NULL)
+	    usleep(1000);
+    }
+    if (shm == NULL) {
+	fprintf(stderr, "mystress: %s never published %s\n", shell, name);
+	kill(tsh, SIGKILL);
+	exit(1);
+    }
+
+    /* let mychaos loose on the jobs */
+    if ((chaos = fork()) == 0) {
+	sprintf(arg, "%d", nsigs);
+	sprintf(line, "%d", tsh);
+	execl("./mychaos", "./mychaos", line, arg, "500", (char *)NULL);
+	perror("./mychaos");
+	exit(1);
+    }
+
+    for (i=0; i < lines; i++) {
+	switch (rand() % 12) {
+	case 0: case 1: case 2: /* instantly exiting bg job */
+	    sprintf(line, "./myexit %d &\n", rand() % 3);
+	    break;
+	case 3: case 4: /* pipeline, one SIGCHLD per stage */
+	    strcpy(line, "./myexit");
+	    for (k = 1 + rand() % 8; k > 0; k--)
+		strcat(line, " | ./myexit");
+	    strcat(line, " &\n");
+	    break;
+	case 5: /* process group full of short children */
+	    sprintf(line, "./myburst %d &\n", 1 + rand() % 50);
+	    break;
+	case 6: /* foreground job */
+	    strcpy(line, "./myexit\n");
+	    break;
+	case 7: /* background list run by a copy of the shell */
+	    strcpy(line, "./myexit 1 || ./myexit && ./myexit &\n");
+	    break;
+	case 8:
+	    sprintf(line, "bg %%%d\n", 1 + rand() % 16);
+	    break;
+	case 9:
+	    sprintf(line, "fg %%%d\n", 1 + rand() % 16);
+	    break;
+	case 10:
+	    strcpy(line, "wait -n\n");
+	    break;
+	default:
+	    strcpy(line, "jobs\n");
+	}
+	if (fputs(line, to) == EOF)
+	    break; /* shell died */
+
+	snapshot(shm, &copy);
+	corrupt += checkjobs(&copy) > 0;
+	/* don't run far ahead of the shell or the job list overflows */
+	while (shm->nforked > shm->nreaped + 200)
+	    usleep(100);
+    }
+    waitpid(chaos, NULL, 0);
+
+    /* continue whatever is still stopped and let the shell drain */
+    deadline = time(NULL) + 20;
+    do {
+	snapshot(shm, &copy);
+	corrupt += checkjobs(&copy) > 0;
+	njobs = 0;
+	for (i=0; i < JOBSHM_MAXJOBS; i++) {
+	    if (copy.jobs[i].pid > 0) {
+		njobs++;
+		kill(-copy.jobs[i].pid, SIGCONT);
+	    }
+	}
+	if (njobs > 0 || copy.nforked != copy.nreaped)
+	    usleep(10000);
+	else
+	    break;
+    } while (time(NULL) < deadline);
+
+    nzombies = zombies(tsh);
+    fputs("quit\n", to);
+    fclose(to);
+    waitpid(tsh, NULL, 0);
+
+    printf("mystress: %d lines, %d chaos signals\n", lines, nsigs);
+    printf("  forked %lu, reaped %lu\n", copy.nforked, copy.nreaped);
+    printf("  jobs added %lu, deleted %lu, stops %lu\n",
+	   copy.nadded, copy.ndeleted, copy.nstopped);
+    printf("  job list full %d times\n",
+	   countlines(OUTFILE, "Tried to create too many jobs"));
+    printf("  jobs left %d, zombies %d, corrupt snapshots %d\n",
+	   njobs, nzombies, corrupt);
+
+    if (copy.nforked != copy.nreaped) {
+	printf("FAIL: %lu lost reaps\n", copy.nforked - copy.nreaped);
+	failed = 1;
+    }
+    if (njobs > 0 || copy.nadded != copy.ndeleted) {
+	printf("FAIL: job list did not drain\n");
+	failed = 1;
+    }
+    if (nzombies > 0) {
+	printf("FAIL: zombie children\n");
+	failed = 1;
+    }
+    if (corrupt > 0) {
+	printf("FAIL: job list corrupted\n");
+	failed = 1;
+    }
+    if (countlines(OUTFILE, "waitpid error") > 0) {
+	printf("FAIL: waitpid error\n");
+	failed = 1;
+    }
+    if ((k = countlines(OUTFILE, "^[0] ")) > 0) {
+	printf("FAIL: %d jobs announced as job 0\n", k);
+	failed = 1;
+    }
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    exit(failed);
+}
+
+/*
+ * snapshot - Take a consistent copy of the job status segment
+ */
+void snapshot(const struct jobshm_t *shm, struct jobshm_t *copy)
+{
+    unsigned before, after;
+
+    do {
+	before = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+	if (before & 1)
+	    continue;
+	memcpy(copy, shm, sizeof(*copy));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+/*
+ * checkjobs - Count the broken invariants in a job list snapshot: bad
+ *    states or stage counts, and job IDs or PIDs used twice
+ */
+int checkjobs(const struct jobshm_t *copy)
+{
+    const struct jobstat_t *a, *b;
+    int i, j, bad = 0, fg = 0;
+
+    for (i=0; i < JOBSHM_MAXJOBS; i++) {
+	a = &copy->jobs[i];
+	if (a->pid == 0)
+	    continue;
+	if (a->jid < 1 || a->state < 1 || a->state > 3 ||
+	    a->nproc < 1 || a->nproc > JOBSHM_MAXPROC)
+	    bad++;
+	fg += a->state == 1;
+	for (j=i+1; j < JOBSHM_MAXJOBS; j++) {
+	    b = &copy->jobs[j];
+	    if (b->pid != 0 && (b->jid == a->jid || b->pid == a->pid))
+		bad++;
+	}
+    }
+    return bad + (fg > 1);
+}
+
+/*
+ * zombies - Count the zombie children of process ppid
+ */
+int zombies(pid_t ppid)
+{
+    DIR *dir;
+    struct dirent *de;
+    char path[300], buf[512], *p, state;
+    int parent, n = 0, len;
+    FILE *fp;
+
+    if ((dir = opendir("/proc")) == NULL)
+	return 0;
+    while ((de = readdir(dir)) != NULL) {
+	if (de->d_name[0] < '0' || de->d_name[0] > '9')
+	    continue;
+	sprintf(path, "/proc/%s/stat", de->d_name);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	len = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[len > 0 ? len : 0] = '\0';
+	if ((p = strrchr(buf, ')')) == NULL)
+	    continue;
+	if (sscanf(p + 2, "%c %d", &state, &parent) == 2 &&
+	    parent == ppid && state == 'Z')
+	    n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+/*
+ * countlines - Count the lines of file that contain text, or that
+ *    start with it if text begins with '^'
+ */
+int countlines(const char *file, const char *text)
+{
+    char buf[1024];
+    int n = 0;
+    FILE *fp;
+
+    if ((fp = fopen(file, "r")) == NULL)
+	return 0;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+	if (text[0] == '^')
+	    n += strncmp(buf, text + 1, strlen(text + 1)) == 0;
+	else
+	    n += strstr(buf, text) != NULL;
+    }
+    fclose(fp);
+    return n;
+}
@@ -5,7 +5,9 @@
  */
 
 // test test
+#define _GNU_SOURCE /* F_SETPIPE_SZ */
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <signal.h>
 #include <stddef.h>
@@ -14,15 +16,39 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include "jobshm.h"
 
 /* Misc manifest constants */
 #define MAXLINE 1024   /* max line size */
-#define MAXARGS 128    /* max args on a command line */
 #define MAXJOBS 16     /* max jobs at any point in time */
 #define MAXJID 1 << 16 /* max job ID */
 #define MAXPIPE 16     /* max pipes */
+#define MAXLIST 32     /* max pipelines in a ; && || list */
+#define MAXCOPROC 8    /* max coprocesses at any point in time */
+#define NCACHE 64      /* compiled command lines kept, see compileline */
+
+#if MAXJOBS > JOBSHM_MAXJOBS || MAXPIPE > JOBSHM_MAXPROC
+#error "job status segment is smaller than the job list"
+#endif
+
+/* Bump a counter in the job status segment, if we publish one */
+#define COUNT(field)                                                           \
+  do {                                                                         \
+    if (jobshm != NULL)                                                        \
+      jobshm->field++;                                                         \
+  } while (0)
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -30,6 +56,23 @@
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
 
+/* Resource limits, indexes into limits_t.rlim */
+#define LIM_CPU 0    /* -t  RLIMIT_CPU, seconds */
+#define LIM_AS 1     /* -v  RLIMIT_AS, bytes */
+#define LIM_NOFILE 2 /* -n  RLIMIT_NOFILE */
+#define LIM_NPROC 3  /* -u  RLIMIT_NPROC */
+#define NLIMITS 4
+
+/* Word flags in a compiled command line, see cmd_t */
+#define W_QUOTED 1 /* in single quotes, taken literally */
+#define W_VARS 2   /* has a $ to expand */
+#define W_GLOB 4   /* has an unquoted *, ? or [...] */
+
+/* List connectors */
+#define OP_SEQ 0 /* ';' (or end of line) */
+#define OP_AND 1 /* '&&' */
+#define OP_OR 2  /* '||' */
+
 /*
  * Jobs states: FG (foreground), BG (background), ST (stopped)
  * Job state transitions and enabling actions:
@@ -46,50 +89,213 @@ char prompt[] = "tsh> "; /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;         /* if true, print additional output */
 int nextjid = 1;         /* next job ID to allocate */
 char sbuf[MAXLINE];      /* for composing sprintf messages */
+int subshell = 0;        /* if true, we are a child running a bg list */
+int oneshot = 0;         /* if true, running a -c line: exec the last command */
+int ttyfd = -1;          /* our controlling terminal, -1 if stdin isn't one */
+pid_t shellpgid;         /* our process group, the terminal's when idle */
+struct termios shelltmodes; /* terminal modes for the shell itself */
+int builtin_status = 0;  /* exit status of the last builtin command */
+long pipesz = 0;         /* pipe buffer size (-P, pipesize), 0 = default */
+char **envp = NULL;      /* snapshot of environ that children execve with */
+int nenvp = 0;           /* number of entries in envp */
+char **pathv = NULL;     /* directories of $PATH, in search order */
+int envdirty = 1;        /* environ changed since envp was built */
+volatile sig_atomic_t fgstatus; /* wait status of the last finished FG job */
+volatile sig_atomic_t interrupted; /* set by ctrl-c with no FG job */
 
 struct job_t {           /* The job struct */
-  pid_t pid;             /* job PID */
+  pid_t pid;             /* job PID (process group leader) */
   int jid;               /* job ID [1, 2, ...] */
   int state;             /* UNDEF, BG, FG, or ST */
+  int nproc;             /* number of processes (pipeline stages) */
+  pid_t pids[MAXPIPE];   /* stage PIDs, 0 once reaped */
+  int status;            /* wait status of the last stage */
+  int cgroup;            /* cgroup number (see newcgroup), 0 if none */
+  struct timespec start; /* when the job was added */
+  int hastmodes;         /* tmodes is set: the job stopped in the fg */
+  struct termios tmodes; /* terminal modes to resume the job with */
   char cmdline[MAXLINE]; /* command line */
 };
 struct job_t jobs[MAXJOBS]; /* The job list */
+
+struct done_t {          /* A finished job, kept for the wait builtin */
+  pid_t pid;             /* job PID */
+  int jid;               /* job ID it had */
+  int status;            /* wait status of the last stage */
+};
+struct done_t done[MAXJOBS]; /* Ring of the most recently finished jobs */
+volatile sig_atomic_t ndone; /* Number of jobs ever finished */
+
+struct limits_t {        /* Resource limits for a job */
+  unsigned set;          /* bit i set if rlim[i] is to be applied */
+  rlim_t rlim[NLIMITS];  /* setrlimit values, see LIM_ */
+  long memmax;           /* cgroup memory.max in bytes, 0 if not set */
+  int cpupct;            /* cgroup cpu.max in % of one CPU, 0 if not set */
+};
+struct limits_t limits;  /* Defaults for new jobs, set by ulimit */
+
+char cgroot[MAXLINE];    /* Our cgroup v2 directory, "" if not made yet */
+char cgorig[MAXLINE];    /* The cgroup the shell was started in */
+int cgstate = 0;         /* 0 untried, 1 usable, -1 unavailable */
+pid_t cgpid;             /* Shell that made cgroot */
+pid_t cgself;            /* Shell (or bg list) that made the job cgroups */
+int ncgroups = 0;        /* Job cgroups made so far */
+
+struct coproc_t {        /* A coprocess, see do_coproc */
+  char name[32];         /* NAME, "" if the slot is free */
+  pid_t pid;             /* its job PID */
+  int in;                /* write end of its stdin */
+  int out;               /* read end of its stdout */
+  char *buf;             /* output read but not yet returned by coread */
+  size_t nbuf;           /* bytes in buf */
+  size_t size;           /* bytes allocated for buf, see cofill */
+};
+struct coproc_t coprocs[MAXCOPROC]; /* The coprocesses */
+
+struct jobshm_t *jobshm = NULL; /* Published job list (-m), see jobshm.h */
+pid_t shmpid;                   /* Shell that created the segment */
+
+struct args_t {          /* A growable argv, see addarg */
+  char **argv;           /* NULL terminated words */
+  int argc;              /* number of words */
+  int size;              /* slots allocated in argv */
+};
+
+struct dircache_t {      /* A directory read for globbing */
+  char *path;            /* as written in the pattern, "" for the cwd */
+  char *names;           /* the entry names, each NUL terminated */
+  size_t *name;          /* offset of each entry's name in names */
+  unsigned char *type;   /* d_type of each entry */
+  int n;                 /* number of entries, -1 if it can't be read */
+  struct dircache_t *next;
+};
+struct dircache_t *dircache = NULL; /* Directories read for this line */
+
+struct argblock_t {      /* Storage for the words made by globbing */
+  struct argblock_t *next;
+  size_t used, size;
+  char data[];
+};
+struct argblock_t *argblocks = NULL; /* Blocks used for this line */
+
+struct cmd_t {           /* A pipeline split into words, see compileline */
+  unsigned long hash;    /* hash of line, 0 if the slot is free */
+  char line[MAXLINE];    /* the pipeline as given to eval_cmd */
+  char words[MAXLINE + 1]; /* line with each word NUL terminated */
+  short word[MAXLINE / 2 + 1]; /* offset of each word in words */
+  unsigned char flags[MAXLINE / 2 + 1]; /* W_ flags of each word */
+  short stage[MAXPIPE + 1]; /* first word of each stage, then nwords */
+  int nstages;           /* number of pipeline stages */
+  int redirs;            /* a word may be a redirection operator */
+};
+struct cmd_t cmdcache[NCACHE]; /* Compiled lines, by hash */
+
+struct parsestat_t {     /* compileline counters, reported with -v */
+  unsigned long lookups; /* lines looked up */
+  unsigned long hits;    /* lines found already compiled */
+  double missus;         /* microseconds spent compiling misses */
+  double hitus;          /* microseconds spent finding hits */
+};
+struct parsestat_t parsestat;
+pid_t statpid;           /* Shell that reports parsestat */
 /* End global variables */
 
 /* Function prototypes */
 
 /* Here are the functions that you will implement */
-void eval(char *cmdline);
+int eval(char *cmdline);
+int eval_cmd(char *cmdline, int tail);
+void closeredirs(int in_fd, int out_fd, int err_fd);
+int eval_list(char lines[MAXLIST][MAXLINE], int *ops, int n);
+int eval_loop(char *cmdline);
 int builtin_cmd(char **argv);
 void do_bgfg(char **argv);
-void waitfg(pid_t pid);
+void do_wait(char **argv);
+void do_export(char **argv);
+void do_ulimit(char **argv);
+void do_coproc(char **argv);
+void do_cosend(char **argv);
+void do_coread(char **argv);
+void do_coclose(char **argv);
+ssize_t cofill(struct coproc_t *co);
+int waitfg(pid_t pid);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 
-void execute_pipe(char *cmds[MAXPIPE][MAXARGS], int n);
+int execute_pipe(char **cmds[MAXPIPE], int n, int bg, char *cmdline,
+                 long size, struct limits_t *lim, int tail);
 
 /* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, char **argv, char *cmds[MAXPIPE][MAXARGS]); //modified to work with pipes
+struct cmd_t *compileline(const char *cmdline);
+int parseline(struct cmd_t *cmd, char **cmds[MAXPIPE]); //modified to work with pipes
+void parsestats(void);
+int parselist(const char *cmdline, char lines[MAXLIST][MAXLINE], int *ops, int *bg);
+int exitcode(int status);
+long parsesize(const char *arg);
+void setpipesz(int fd, long size);
+char *expandvars(const char *word);
+void addarg(struct args_t *args, char *word);
+int isglob(const char *word);
+void globword(char *pat, struct args_t *args);
+void globdir(char *path, size_t len, char *pat, struct args_t *args);
+struct dircache_t *readdircache(const char *path);
+char *argstr(const char *s);
+void globreset(void);
+int cmpstr(const void *a, const void *b);
+int nassign(char **argv);
+void setvar(char *assign);
+void buildenv(void);
+void execcmd(char **argv);
+void tryexec(char *path, char **argv, char **env);
+void shiftargs(char **argv, int n);
+int canexec(struct limits_t *lim);
+int parselimits(char **argv, struct limits_t *lim);
+void setlimits(struct limits_t *lim);
+int newcgroup(struct limits_t *lim);
+void initcgroup(void);
+char *cgpath(char *buf, int cg, char *file);
+int writecg(int cg, char *file, char *value);
+int writepath(const char *path, const char *value);
+long readcg(int cg, char *file, char *key);
+void joincgroup(int cg);
+void removecgroup(int cg);
+void removecgroot(void);
+void listcgroup(int cg);
 void sigquit_handler(int sig);
+void initterm(void);
+void childtty(pid_t pgid, int fg);
+void givetty(struct job_t *job);
+void taketty(struct job_t *job);
 
 void clearjob(struct job_t *job);
 void initjobs(struct job_t *jobs);
 int maxjid(struct job_t *jobs);
 int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
+int addproc(struct job_t *job, pid_t pid);
+void dropjob(pid_t *pids, int n, int cg);
 int deletejob(struct job_t *jobs, pid_t pid);
 pid_t fgpid(struct job_t *jobs);
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid);
+struct job_t *getjobarg(char *arg);
+struct coproc_t *getcoproc(char *name);
+struct done_t *getdonepid(pid_t pid);
 int pid2jid(pid_t pid);
 void listjobs(struct job_t *jobs);
+void initshm(void);
+void removeshm(void);
+void publishjob(struct job_t *job);
 
 void usage(void);
 void unix_error(char *msg);
 void app_error(char *msg);
 typedef void handler_t(int);
 handler_t *Signal(int signum, handler_t *handler);
+char *sio_cat(char *dst, const char *src, char *end);
+char *sio_ltoa(char *dst, long v, char *end);
+void sio_jobmsg(int jid, pid_t pid, char *what, int sig);
 
 void redirect_input(const char *input_file);
 void redirect_output(const char *output_file, int append);
@@ -101,14 +307,11 @@ void redirect_error(const char *error_file);
 int main(int argc, char **argv) {
   char c;
   char cmdline[MAXLINE];
+  char *oneline = NULL; /* -c command line */
   int emit_prompt = 1; /* emit prompt (default) */
 
-  /* Redirect stderr to stdout (so that driver will get all output
-   * on the pipe connected to stdout) */
-  dup2(1, 2);
-
   /* Parse the command line */
-  while ((c = getopt(argc, argv, "hvp")) != EOF) {
+  while ((c = getopt(argc, argv, "hvpmP:c:")) != EOF) {
     switch (c) {
     case 'h': /* print help message */
       usage();
@@ -119,11 +322,43 @@ int main(int argc, char **argv) {
     case 'p':          /* don't print a prompt */
       emit_prompt = 0; /* handy for automatic testing */
       break;
+    case 'm': /* publish the job list for tshtop */
+      initshm();
+      break;
+    case 'P': /* pipe buffer size */
+      if ((pipesz = parsesize(optarg)) < 0)
+        usage();
+      break;
+    case 'c': /* run one command line and exit with its status */
+      oneline = optarg;
+      break;
     default:
       usage();
     }
   }
 
+  /* With -v, say what the command line cache saved when we exit */
+  statpid = getpid();
+  if (verbose)
+    atexit(parsestats);
+
+  /* A -c line runs like a bg list: no prompt, no job control, children
+   * stay in our process group, and the last command replaces us (see
+   * canexec). Only the SIGCHLD handler is needed, for waitfg. */
+  if (oneline != NULL) {
+    oneshot = subshell = 1;
+    Signal(SIGCHLD, sigchld_handler);
+    snprintf(cmdline, MAXLINE, "%s\n", oneline);
+    exit(eval(cmdline));
+  }
+
+  /* Redirect stderr to stdout (so that driver will get all output
+   * on the pipe connected to stdout) */
+  dup2(1, 2);
+
+  /* Take the terminal, if we have one, before any job can */
+  initterm();
+
   /* Install the signal handlers */
 
   /* These are the ones you will need to implement */
@@ -164,187 +399,666 @@ int main(int argc, char **argv) {
 /*
  * eval - Evaluate the command line that the user has just typed in
  *
+ * The line is split into a list of pipelines joined by ';', '&&' and
+ * '||' (see parselist), which are run in order by eval_list. A list
+ * of more than one pipeline that ends in '&' runs as a single
+ * background job: we fork a copy of the shell to evaluate the list
+ * and put that copy in the job list. A line that starts with repeat
+ * or for is a loop, run by eval_loop. Return the status of the last
+ * pipeline run, 0 for a background list.
+ */
+int eval(char *cmdline) {
+    static char lines[MAXLIST][MAXLINE]; // Pipelines of the list
+    int ops[MAXLIST]; // Connector after each pipeline
+    int n, bg, status, jid;
+    pid_t pid;
+    sigset_t mask, prev;
+
+    if ((n = eval_loop(cmdline)) >= 0)
+        return n;
+    n = parselist(cmdline, lines, ops, &bg);
+    if (n <= 1 || !bg)
+        return eval_list(lines, ops, n);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT); // pending until the child resets them
+    sigaddset(&mask, SIGTSTP);
+    sigprocmask(SIG_BLOCK, &mask, &prev); // don't reap before addjob
+    fflush(stdout);
+    if ((pid = fork()) == 0) { // Child runs the whole list
+        setpgid(0, 0);
+        childtty(0, 0);
+        ttyfd = -1; // only the interactive shell moves the terminal
+        subshell = 1;
+        if (jobshm != NULL) { // the list's own jobs stay private
+          munmap(jobshm, sizeof(struct jobshm_t));
+          jobshm = NULL;
+        }
+        initjobs(jobs);
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        status = eval_list(lines, ops, n);
+        removecgroot(); // if the list made its own, _exit won't
+        fflush(stdout);
+        _exit(status); // exit() would rewind a stdin file we share
+    }
+    COUNT(nforked);
+    setpgid(pid, pid);
+    if (!addjob(jobs, pid, BG, cmdline)) {
+        dropjob(&pid, 1, 0);
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return 1;
+    }
+    jid = pid2jid(pid); // before it can be reaped
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    printf("[%d] (%d) %s", jid, pid, cmdline);
+    return 0;
+}
+
+/*
+ * eval_list - Run n pipelines in order, honouring the connectors in
+ *    ops. A pipeline after '&&' only runs if the previous status was 0,
+ *    one after '||' only if it was not; skipped pipelines are never
+ *    forked and leave the status alone. Return the last status.
+ */
+int eval_list(char lines[MAXLIST][MAXLINE], int *ops, int n) {
+    int i, status = 0;
+
+    for (i = 0; i < n; i++) {
+        if (i > 0 && ops[i - 1] == OP_AND && status != 0)
+            continue;
+        if (i > 0 && ops[i - 1] == OP_OR && status == 0)
+            continue;
+        status = eval_cmd(lines[i], oneshot && i == n - 1);
+    }
+    return status;
+}
+
+/*
+ * eval_loop - Run the line if it is a loop, "repeat N body" or
+ *    "for NAME in words...; do body; done", and return the status of
+ *    the last time round (0 if it never ran); return -1 if it is not.
+ *
+ * The body is a list, split once here, and each pipeline in it is
+ * compiled the first time round (see compileline), so later times
+ * round only expand and run it. The for words are expanded once, up
+ * front, and NAME is set to each in turn. A body that is itself a
+ * loop, or a list to run in the background, goes back through eval.
+ * A ctrl-c ends the loop. Loops only start a line: "a; repeat 2 b"
+ * runs a command called repeat.
+ */
+int eval_loop(char *cmdline) {
+    char line[MAXLINE], body[MAXLINE], *p, *name, *list, *end;
+    char lines[MAXLIST][MAXLINE]; // the body, split once
+    char **cmds[MAXPIPE];
+    struct args_t words = {NULL, 0, 0}; // for words, or none for repeat
+    long i, count;
+    int n, ops[MAXLIST], bg, quote, nested, status = 0, save = oneshot;
+
+    p = cmdline + strspn(cmdline, " ");
+    if (strncmp(p, "repeat ", 7) == 0) {
+        count = strtol(p + 7, &end, 10);
+        if (end == p + 7 || *end != ' ' || count < 0 ||
+            end[strspn(end, " ")] == '\n' || end[strspn(end, " ")] == '\0') {
+            printf("repeat: usage: repeat N cmdline\n");
+            return 1;
+        }
+        snprintf(body, MAXLINE, "%s", end);
+    } else if (strncmp(p, "for ", 4) == 0) {
+        snprintf(line, MAXLINE, "%s", p + 4);
+        line[strcspn(line, "\n")] = '\0';
+        name = p = line + strspn(line, " ");
+        while (isalnum(*p) || *p == '_')
+            p++;
+        list = p + strspn(p, " ");
+        if (isdigit(*name) || p == name || *p != ' ' ||
+            strncmp(list, "in", 2) != 0 || (list[2] != ' ' && list[2] != ';'))
+            goto syntax;
+        *p = '\0';
+        for (p = list += 2, quote = 0; *p && (quote || *p != ';'); p++)
+            quote ^= *p == '\'';
+        if (*p != ';')
+            goto syntax;
+        *p++ = '\0';
+        p += strspn(p, " ");
+        if (strncmp(p, "do ", 3) != 0)
+            goto syntax;
+        p += 3;
+        end = p + strlen(p);
+        while (end > p && end[-1] == ' ')
+            end--;
+        if (end - p < 4 || strncmp(end - 4, "done", 4) != 0)
+            goto syntax;
+        for (end -= 4; end > p && end[-1] == ' '; end--)
+            ;
+        if (end == p || end[-1] != ';')
+            goto syntax;
+        end[-1] = '\0';
+        if (strspn(p, " ") == strlen(p))
+            goto syntax;
+        snprintf(body, MAXLINE, "%s\n", p);
+
+        strcat(list, "\n"); // fits, it replaces the ';'
+        parseline(compileline(list), cmds);
+        for (i = 0; cmds[0][i] != NULL; i++)
+            addarg(&words, strdup(cmds[0][i])); // outlive the next line
+        count = words.argc;
+    } else {
+        return -1;
+    }
+
+    oneshot = 0; // the last command runs more than once
+    p = body + strspn(body, " ");
+    nested = strncmp(p, "repeat ", 7) == 0 || strncmp(p, "for ", 4) == 0;
+    n = nested ? 1 : parselist(body, lines, ops, &bg);
+    interrupted = 0;
+    for (i = 0; i < count && n > 0; i++) {
+        if (words.argv != NULL) {
+            setenv(name, words.argv[i], 1);
+            envdirty = 1;
+        }
+        if (nested || (n > 1 && bg))
+            status = eval(body);
+        else
+            status = eval_list(lines, ops, n);
+        if (interrupted || status == 128 + SIGINT)
+            break;
+    }
+    oneshot = save;
+    for (i = 0; i < words.argc; i++)
+        free(words.argv[i]);
+    free(words.argv);
+    return n > 0 ? status : 1;
+
+syntax:
+    printf("for: syntax error, expected for NAME in words...; do cmdline; done\n");
+    return 1;
+}
+
+/*
+ * eval_cmd - Evaluate a single pipeline
+ *
  * If the user has requested a built-in command (quit, jobs, bg or fg)
  * then execute it immediately. Otherwise, fork a child process and
  * run the job in the context of the child. If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
- * each child process must have a unique process group ID so that our
- * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.
- */
-void eval(char *cmdline) {
-    char *argv[MAXARGS]; // Argument list execve()
-    char buf[MAXLINE]; // Holds modified command line
-    char *cmds[MAXPIPE][MAXARGS]; // Commands for pipes
+ * the foreground, wait for it to terminate and then return its exit
+ * status.  Note: each child process must have a unique process group
+ * ID so that our background children don't receive SIGINT (SIGTSTP)
+ * from the kernel when we type ctrl-c (ctrl-z) at the keyboard.
+ * If tail is set (the last pipeline of a -c line), a foreground
+ * external command is exec'd by the shell itself instead of forked.
+ */
+int eval_cmd(char *cmdline, int tail) {
+    char **argv; // Argument list execve()
+    struct cmd_t *cmd; // Compiled command line
+    char **cmds[MAXPIPE]; // Commands for pipes
     int bg; // Should the job run in bg or fg?
     pid_t pid; // Process id
     int in_fd = -1, out_fd = -1, err_fd = -1; // File descriptors for redirection
-    int append = 0; // Append flag for output redirection
-    int pipefd[2]; // File descriptors for pipe
-    int pipe_present = 0; // Flag to check if pipe is present
+    long size = pipesz; // Pipe buffer size for this pipeline
+    struct limits_t lim = limits; // Resource limits for this pipeline
+    int cg, k, jid = 0; // Job cgroup, words used by a prefix, job ID
+    struct coproc_t *co; // Coprocess named by >&NAME or <&NAME
+    sigset_t mask, prev; // Signal masks around fork/addjob
 
-    strcpy(buf, cmdline);
-    bg = parseline(buf, argv, cmds);
+    cmd = compileline(cmdline);
+    bg = parseline(cmd, cmds);
 
     int num_cmds = 0;
-    while (cmds[num_cmds][0] != NULL)
+    while (num_cmds < MAXPIPE && cmds[num_cmds][0] != NULL)
         num_cmds++;
 
-    if (num_cmds == 1) {
-        // Check for redirection operators
-        for (int i = 0; argv[i] != NULL; i++) {
-            if (strcmp(argv[i], "<") == 0) {
-                in_fd = open(argv[i + 1], O_RDONLY);
-                if (in_fd < 0) {
-                    perror("open");
-                    return;
-                }
-                argv[i] = NULL;
-            } else if (strcmp(argv[i], ">") == 0) {
-                out_fd = open(argv[i + 1], O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
-                if (out_fd < 0) {
-                    perror("open");
-                    return;
-                }
-                argv[i] = NULL;
-            } else if (strcmp(argv[i], ">>") == 0) {
-                out_fd = open(argv[i + 1], O_WRONLY | O_CREAT | O_APPEND, S_IRWXU | S_IRWXG | S_IRWXO);
-                if (out_fd < 0) {
-                    perror("open");
-                    return;
-                }
-                argv[i] = NULL;
-            } else if (strcmp(argv[i], "2>") == 0) {
-                err_fd = open(argv[i + 1], O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
-                if (err_fd < 0) {
-                    perror("open");
-                    return;
-                }
-                argv[i] = NULL;
+    if (num_cmds == 0)
+        return 0;
+
+    // "pipesize N cmd ..." and "ulimit -opts cmd ..." only apply to
+    // this pipeline
+    for (;;) {
+        if (strcmp(cmds[0][0], "pipesize") == 0 && cmds[0][1] != NULL &&
+            cmds[0][2] != NULL) {
+            if ((size = parsesize(cmds[0][1])) < 0) {
+                printf("pipesize: %s: Bad size\n", cmds[0][1]);
+                return 1;
             }
+            k = 2;
+        } else if (strcmp(cmds[0][0], "ulimit") == 0) {
+            if ((k = parselimits(cmds[0], &lim)) < 0)
+                return 1;
+            if (cmds[0][k] == NULL) // no command, the builtin sets defaults
+                break;
+        } else {
+            break;
         }
+        shiftargs(cmds[0], k);
+    }
 
-        if (!builtin_cmd(argv)) {
-            if ((pid = fork()) == 0) { // Child process
-                setpgid(0, 0);
-
-                // Handle input redirection
-                if (in_fd != -1) {
-                    dup2(in_fd, STDIN_FILENO);
-                    close(in_fd);
-                }
-
-                // Handle output redirection
-                if (out_fd != -1) {
-                    dup2(out_fd, STDOUT_FILENO);
-                    close(out_fd);
-                }
-
-                // Handle error redirection
-                if (err_fd != -1) {
-                    dup2(err_fd, STDERR_FILENO);
-                    close(err_fd);
-                }
-
-                if (execvp(argv[0], argv) < 0) {
-                    perror(argv[0]);
-                    exit(0);
-                }
+    if (num_cmds > 1)
+        return execute_pipe(cmds, num_cmds, bg, cmdline, size, &lim,
+                            tail && !bg && canexec(&lim));
+    argv = cmds[0];
+
+    // Check for redirection operators, if the line may have any
+    for (int i = 0; cmd->redirs && argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "<") == 0) {
+            in_fd = open(argv[i + 1], O_RDONLY);
+            if (in_fd < 0) {
+                perror("open");
+                closeredirs(in_fd, out_fd, err_fd);
+                return 1;
             }
-            if (!bg) {
-                waitfg(pid);
-            } else {
-                addjob(jobs, pid, BG, cmdline);
-                printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
+            argv[i] = NULL;
+        } else if (strcmp(argv[i], ">") == 0) {
+            out_fd = open(argv[i + 1], O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
+            if (out_fd < 0) {
+                perror("open");
+                closeredirs(in_fd, out_fd, err_fd);
+                return 1;
             }
+            argv[i] = NULL;
+        } else if (strcmp(argv[i], ">>") == 0) {
+            out_fd = open(argv[i + 1], O_WRONLY | O_CREAT | O_APPEND, S_IRWXU | S_IRWXG | S_IRWXO);
+            if (out_fd < 0) {
+                perror("open");
+                closeredirs(in_fd, out_fd, err_fd);
+                return 1;
+            }
+            argv[i] = NULL;
+        } else if (strcmp(argv[i], "2>") == 0) {
+            err_fd = open(argv[i + 1], O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG | S_IRWXO);
+            if (err_fd < 0) {
+                perror("open");
+                closeredirs(in_fd, out_fd, err_fd);
+                return 1;
+            }
+            argv[i] = NULL;
+        } else if (strncmp(argv[i], ">&", 2) == 0 ||
+                   strncmp(argv[i], "<&", 2) == 0) {
+            // >&NAME, <&NAME: the input or output of coprocess NAME
+            if ((co = getcoproc(argv[i] + 2)) == NULL) {
+                printf("%s: No such coprocess\n", argv[i] + 2);
+                closeredirs(in_fd, out_fd, err_fd);
+                return 1;
+            }
+            // close-on-exec, or other jobs would hold the pipe open
+            if (argv[i][0] == '>')
+                out_fd = fcntl(co->in, F_DUPFD_CLOEXEC, 0);
+            else
+                in_fd = fcntl(co->out, F_DUPFD_CLOEXEC, 0);
+            argv[i] = NULL;
+        }
+    }
+
+    // A line of NAME=value words only sets them in the shell
+    int nvars = nassign(argv);
+    if (argv[nvars] == NULL) {
+        for (int i = 0; i < nvars; i++)
+            setvar(argv[i]);
+        closeredirs(in_fd, out_fd, err_fd);
+        return 0;
+    }
+    if (builtin_cmd(argv + nvars)) {
+        closeredirs(in_fd, out_fd, err_fd);
+        return builtin_status;
+    }
+    if (envdirty)
+        buildenv(); // once here, not in every child
+
+    tail = tail && !bg && canexec(&lim); // -c: become the command
+    if ((cg = tail ? 0 : newcgroup(&lim)) < 0) {
+        closeredirs(in_fd, out_fd, err_fd);
+        return 1;
+    }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT); // pending until the child resets them
+    sigaddset(&mask, SIGTSTP);
+    sigprocmask(SIG_BLOCK, &mask, &prev); // don't reap before addjob
+    fflush(stdout);
+    if ((pid = tail ? 0 : fork()) == 0) { // Child process, or us for tail
+        if (!subshell)
+            setpgid(0, 0);
+        childtty(getpid(), !bg);
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        joincgroup(cg);
+        setlimits(&lim);
+
+        // Handle input redirection
+        if (in_fd != -1) {
+            dup2(in_fd, STDIN_FILENO);
+            close(in_fd);
+        }
+
+        // Handle output redirection
+        if (out_fd != -1) {
+            dup2(out_fd, STDOUT_FILENO);
+            close(out_fd);
+        }
+
+        // Handle error redirection
+        if (err_fd != -1) {
+            dup2(err_fd, STDERR_FILENO);
+            close(err_fd);
         }
+
+        execcmd(argv);
+    }
+    COUNT(nforked);
+    if (!subshell)
+        setpgid(pid, pid);
+    if (addjob(jobs, pid, bg ? BG : FG, cmdline)) {
+        jid = pid2jid(pid); // before it can be reaped
+        getjobpid(jobs, pid)->cgroup = cg;
+        if (!bg)
+            givetty(getjobpid(jobs, pid));
     } else {
-        execute_pipe(cmds, num_cmds);
+        dropjob(&pid, 1, cg);
+        pid = 0; // nothing to wait for
     }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    // The child has its own copies of the redirection files
+    closeredirs(in_fd, out_fd, err_fd);
+
+    if (pid == 0)
+        return 1;
+    if (!bg)
+        return waitfg(pid);
+    printf("[%d] (%d) %s", jid, pid, cmdline);
+    return 0;
+}
+
+/*
+ * closeredirs - Close the redirection files eval_cmd opened, if any
+ */
+void closeredirs(int in_fd, int out_fd, int err_fd) {
+    if (in_fd != -1)
+        close(in_fd);
+    if (out_fd != -1)
+        close(out_fd);
+    if (err_fd != -1)
+        close(err_fd);
 }
 
 /*
- * parseline - Parse the command line and build the argv array.
+ * parselist - Split the command line into a list of pipelines joined
+ *    by ';', '&&' and '||'. Each pipeline gets its own newline
+ *    terminated copy in lines, ready for eval_cmd, and ops[i] holds
+ *    the connector that follows lines[i]. Connectors inside single
+ *    quotes are left alone. Return the number of pipelines.
  *
- * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.
+ * If there is more than one pipeline and the list ends in '&', the
+ * '&' is removed and *bg is set; a lone pipeline keeps its '&' so
+ * that parseline handles it as before.
  */
+int parselist(const char *cmdline, char lines[MAXLIST][MAXLINE], int *ops, int *bg) {
+  const char *p;
+  int n = 0, len = 0, quote = 0, op;
+
+  *bg = 0;
+  for (p = cmdline;; p++) {
+    if (*p == '\'')
+      quote = !quote;
+    if (*p == '\0' || *p == '\n')
+      op = OP_SEQ;
+    else if (quote)
+      op = -1;
+    else if (*p == ';')
+      op = OP_SEQ;
+    else if (p[0] == '&' && p[1] == '&')
+      op = OP_AND;
+    else if (p[0] == '|' && p[1] == '|')
+      op = OP_OR;
+    else
+      op = -1;
+
+    if (op < 0) { // ordinary character
+      if (len < MAXLINE - 2)
+        lines[n][len++] = *p;
+      continue;
+    }
+
+    lines[n][len] = '\0';
+    if (strspn(lines[n], " ") != (size_t)len) { // skip empty pipelines
+      strcpy(&lines[n][len], "\n");
+      ops[n++] = op;
+    }
+    len = 0;
+    if (*p == '\0' || *p == '\n')
+      break;
+    if (n == MAXLIST) {
+      printf("Too many commands in list\n");
+      return 0;
+    }
+    if (op != OP_SEQ)
+      p++; // two character connector
+  }
+
+  if (n > 1) {
+    char *last = lines[n - 1];
+    len = strlen(last) - 1; // index of the newline
+    while (len > 0 && last[len - 1] == ' ')
+      len--;
+    if (len > 0 && last[len - 1] == '&') {
+      strcpy(&last[len - 1], "\n");
+      *bg = 1;
+    }
+  }
+  return n;
+}
 
-int parseline(const char *cmdline, char **argv, char *cmds[MAXPIPE][MAXARGS]) {
-  static char array[MAXLINE]; // copy of command line
-  char *buf = array;          // ptr for command line
-  char *delim;                // first space delimiter
-  int argc = 0;               // number of args
-  int bg;                     // background job?
-  int pipe_count = 0;         // number of pipes
+/*
+ * compileline - Split a pipeline into stages and words, or find it
+ *    already split. Compiled lines are kept in cmdcache, direct mapped
+ *    by a hash of the line, so a line that is run again (a script
+ *    that repeats itself, a repeat or for body) skips the tokenising.
+ *    Only the splitting is cached: $NAME and patterns are expanded
+ *    afresh by parseline each time the line is run.
+ *
+ * Characters enclosed in single quotes are treated as a single word.
+ * With -v the time spent here is counted for parsestats.
+ */
+struct cmd_t *compileline(const char *cmdline) {
+  struct cmd_t *cmd;
+  struct timespec t0, t1;
+  unsigned long hash = 2166136261UL; // FNV-1a
+  const char *p;
+  char *buf, *stage, *delim, *w;
+  int n = 0, quoted;
+  size_t len;
+
+  if (verbose)
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (p = cmdline; *p; p++)
+    hash = (hash ^ (unsigned char)*p) * 16777619UL;
+  if ((len = p - cmdline) >= MAXLINE)
+    len = MAXLINE - 1;
+  if (hash == 0)
+    hash = 1; // 0 marks a free slot
+  cmd = &cmdcache[hash % NCACHE];
+  parsestat.lookups++;
+  if (cmd->hash == hash && strcmp(cmd->line, cmdline) == 0) {
+    parsestat.hits++;
+    if (verbose) {
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      parsestat.hitus += (t1.tv_sec - t0.tv_sec) * 1e6 +
+                         (t1.tv_nsec - t0.tv_nsec) / 1e3;
+    }
+    return cmd;
+  }
 
-  strcpy(buf, cmdline);
-  buf[strlen(buf) - 1] = ' ';   // replace trailing '\n' with space
+  cmd->hash = hash;
+  memcpy(cmd->line, cmdline, len);
+  cmd->line[len] = '\0';
+  cmd->nstages = 0;
+  cmd->redirs = 0;
+  buf = memcpy(cmd->words, cmd->line, len + 1);
+  if (len > 0 && buf[len - 1] == '\n')
+    buf[len - 1] = ' '; // replace trailing '\n' with space
+  else
+    strcpy(&buf[len], " ");
   while (*buf && (*buf == ' ')) // ignore leading spaces
     buf++;
 
-  while (pipe_count < MAXPIPE) { // make sure not too many pipes
-    cmds[pipe_count][0] = NULL;
-    char *cmd = strtok_r(buf, "|", &buf); // split into buf
-    if (!cmd)
+  while (cmd->nstages < MAXPIPE) { // make sure not too many pipes
+    stage = strtok_r(buf, "|", &buf); // split into buf
+    if (!stage)
       break;
-
-    /* Build the argv list */
-    argc = 0;                     // reset argc for each command
-    while (*cmd && (*cmd == ' ')) // ignore leading spaces
-      cmd++;
-    if (*cmd == '\'') {
-      cmd++;
-      delim = strchr(cmd, '\'');
+    cmd->stage[cmd->nstages++] = n;
+    while (*stage && (*stage == ' ')) // ignore leading spaces
+      stage++;
+    if ((quoted = (*stage == '\''))) {
+      stage++;
+      delim = strchr(stage, '\'');
     } else {
-      delim = strchr(cmd, ' ');
+      delim = strchr(stage, ' ');
     }
 
-    while (delim) {
-      argv[argc++] = cmd;
+    while (delim && n < MAXLINE / 2) {
       *delim = '\0';
-      cmd = delim + 1;
-      while (*cmd && (*cmd == ' ')) // ignore spaces
-        cmd++;
-      if (*cmd == '\'') {
-        cmd++;
-        delim = strchr(cmd, '\'');
+      w = stage;
+      cmd->word[n] = w - cmd->words;
+      cmd->flags[n] = quoted ? W_QUOTED
+                             : (strchr(w, '$') ? W_VARS : 0) |
+                                   (isglob(w) ? W_GLOB : 0);
+      if ((cmd->flags[n] & (W_VARS | W_GLOB)) || strcmp(w, "<") == 0 ||
+          strcmp(w, ">") == 0 || strcmp(w, ">>") == 0 ||
+          strcmp(w, "2>") == 0 || strncmp(w, ">&", 2) == 0 ||
+          strncmp(w, "<&", 2) == 0)
+        cmd->redirs = 1; // eval_cmd has to look for them
+      n++;
+      stage = delim + 1;
+      while (*stage && (*stage == ' ')) // ignore spaces
+        stage++;
+      if ((quoted = (*stage == '\''))) {
+        stage++;
+        delim = strchr(stage, '\'');
       } else {
-        delim = strchr(cmd, ' ');
+        delim = strchr(stage, ' ');
       }
     }
-    argv[argc] = NULL;                                     // null termination
-    memcpy(cmds[pipe_count], argv, argc * sizeof(char *)); // copy array to cmds
-    pipe_count++;
   }
+  cmd->stage[cmd->nstages] = n;
+
+  if (verbose) {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    parsestat.missus += (t1.tv_sec - t0.tv_sec) * 1e6 +
+                        (t1.tv_nsec - t0.tv_nsec) / 1e3;
+  }
+  return cmd;
+}
+
+/*
+ * parseline - Build an argv array for each stage of a compiled
+ *    pipeline in cmds; the stage after the last is empty.
+ *
+ * $NAME and ${NAME} in unquoted words are replaced by the value of
+ * the environment variable (see expandvars), and words with an
+ * unquoted *, ? or [...] are replaced by the sorted pathnames they
+ * match, if any (see globword). Other words point into cmd. The argv
+ * arrays grow as needed and stay valid until the next call.  Return
+ * true if the user has requested a BG job, false if the user has
+ * requested a FG job.
+ */
+int parseline(struct cmd_t *cmd, char **cmds[MAXPIPE]) {
+  static struct args_t args[MAXPIPE]; // argv of each stage
+  static char *empty[1] = {NULL}; // marks the end of the pipeline
+  struct args_t *cur = NULL;      // stage being built
+  char *word;                     // expanded word
+  int bg;                         // background job?
+  int i, s;
+
+  globreset(); // words and directories of the previous line
+  for (s = 0; s < cmd->nstages; s++) {
+    cur = &args[s];
+    cur->argc = 0;                // reset argc for each command
+    addarg(cur, NULL);
+    for (i = cmd->stage[s]; i < cmd->stage[s + 1]; i++) {
+      word = cmd->words + cmd->word[i];
+      if ((cmd->flags[i] & W_VARS) &&
+          (word = expandvars(word)) == NULL)
+        continue;
+      if ((cmd->flags[i] & W_GLOB) ||
+          ((cmd->flags[i] & W_VARS) && isglob(word)))
+        globword(word, cur);
+      else
+        addarg(cur, word);
+    }
+    cmds[s] = cur->argv;
+  }
+  if (s < MAXPIPE)
+    cmds[s] = empty;
 
-  if (argc == 0) /* ignore blank line */
+  if (cur == NULL || cur->argc == 0) /* ignore blank line */
     return 1;
 
   /* should the job run in the background? */
-  if ((bg = (*argv[argc - 1] == '&')) != 0) {
-    argv[--argc] = NULL;
-  }
+  if ((bg = (*cur->argv[cur->argc - 1] == '&')) != 0)
+    cur->argv[--cur->argc] = NULL;
   return bg;
 }
 
+/*
+ * parsestats - Report the compileline counters at exit (-v): the time
+ *    a line took to compile when it missed and to find when it hit.
+ *    The difference is what each hit saved.
+ */
+void parsestats(void) {
+  struct parsestat_t *ps = &parsestat;
+  unsigned long misses = ps->lookups - ps->hits;
+
+  if (getpid() != statpid || ps->lookups == 0)
+    return;
+  printf("parse cache: %lu lines, %lu hits (%.1f%%), "
+         "%.2f us per compile, %.2f us per hit\n",
+         ps->lookups, ps->hits, 100.0 * ps->hits / ps->lookups,
+         misses ? ps->missus / misses : 0, ps->hits ? ps->hitus / ps->hits : 0);
+  fflush(stdout);
+}
+
 /* 
- * execute_pipe - Execute a series of piped commands
+ * execute_pipe - Execute a series of piped commands as one job
  * cmds: An array of commands and their arguments
  * n: The number of commands in the pipes
+ * bg: Run the job in the background?
+ * size: Pipe buffer size in bytes, 0 for the kernel default
+ * lim: Resource limits for every stage
+ * tail: Exec the last stage in the shell itself instead of forking it
+ * Every stage joins the process group (and cgroup) of the first one.
+ * Returns the exit status of the last stage for a foreground job, 0
+ * otherwise.
  */
-void execute_pipe(char *cmds[MAXPIPE][MAXARGS], int n) {
-  int i;
+int execute_pipe(char **cmds[MAXPIPE], int n, int bg, char *cmdline,
+                 long size, struct limits_t *lim, int tail) {
+  int i, cg, jid = 0;
   int fds[MAXPIPE][2]; // array for file descriptors
-  pid_t pid;
+  pid_t pid, pgid = 0;
+  pid_t pids[MAXPIPE];
+  sigset_t mask, prev;
 
+  if ((cg = newcgroup(lim)) < 0)
+    return 1;
   for (i = 0; i < n - 1; i++) { // create the pipes with file descriptors
     pipe(fds[i]);
+    setpipesz(fds[i][1], size);
   }
 
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGINT); // pending until the child resets them
+  sigaddset(&mask, SIGTSTP);
+  if (envdirty)
+    buildenv(); // once here, not in every stage
+  sigprocmask(SIG_BLOCK, &mask, &prev); // don't reap before addjob
+  fflush(stdout);
+
   for (i = 0; i < n; i++) { // run through each command to fork and pipe
-    if ((pid = fork()) == 0) {
+    if ((pid = (tail && i == n - 1) ? 0 : fork()) == 0) {
+      if (!subshell)
+        setpgid(0, pgid);
+      childtty(pgid ? pgid : getpid(), !bg);
+      sigprocmask(SIG_SETMASK, &prev, NULL);
+      joincgroup(cg);
+      setlimits(lim);
       if (i > 0) { // If not the first command, redirect stdin to the previous
                    // pipe's read end
         dup2(fds[i - 1][0], 0);
@@ -361,10 +1075,14 @@ void execute_pipe(char *cmds[MAXPIPE][MAXARGS], int n) {
         close(fds[j][0]);
         close(fds[j][1]);
       }
-      execvp(cmds[i][0], cmds[i]); // exec cmd
-      app_error("execvp");
-      exit(1);
+      execcmd(cmds[i]); // exec cmd
     }
+    COUNT(nforked);
+    if (pgid == 0)
+      pgid = pid;
+    if (!subshell)
+      setpgid(pid, pgid);
+    pids[i] = pid;
   }
 
   for (i = 0; i < n - 1; i++) { // close all pipes
@@ -372,19 +1090,37 @@ void execute_pipe(char *cmds[MAXPIPE][MAXARGS], int n) {
     close(fds[i][1]);
   }
 
-  for (i = 0; i < n; i++) { // wait for everything to finish
-    wait(NULL);
+  if (addjob(jobs, pgid, bg ? BG : FG, cmdline)) {
+    jid = pid2jid(pgid); // before it can be reaped
+    for (i = 1; i < n; i++) // leader was added by addjob
+      addproc(getjobpid(jobs, pgid), pids[i]);
+    getjobpid(jobs, pgid)->cgroup = cg;
+    if (!bg)
+      givetty(getjobpid(jobs, pgid));
+  } else {
+    dropjob(pids, n, cg);
+    pgid = 0; // nothing to wait for
   }
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+
+  if (pgid == 0)
+    return 1;
+  if (!bg)
+    return waitfg(pgid);
+  printf("[%d] (%d) %s", jid, pgid, cmdline);
+  return 0;
 }
 
 /*
  * builtin_cmd - If the user has typed a built-in command then execute
- *    it immediately.  (jobs,  quit, bg, fg)
+ *    it immediately.  (jobs,  quit, bg, fg, wait, export, unset,
+ *    ulimit, pipesize)
  */
 int builtin_cmd(char **argv) {
   if (argv == NULL) {
     return 0;
   } // no command, return 0
+  builtin_status = 0;
   if (strcmp(argv[0], "jobs") == 0) { // lists running jobs
     listjobs(jobs);
     return 1; // success
@@ -398,6 +1134,46 @@ int builtin_cmd(char **argv) {
     do_bgfg(argv);
     return 1;
   }
+  if (strcmp(argv[0], "wait") == 0) { // waits for background jobs
+    do_wait(argv);
+    return 1;
+  }
+  if (strcmp(argv[0], "export") == 0 ||
+      strcmp(argv[0], "unset") == 0) { // changes environment variables
+    do_export(argv);
+    return 1;
+  }
+  if (strcmp(argv[0], "ulimit") == 0) { // shows or sets job limits
+    do_ulimit(argv);
+    return 1;
+  }
+  if (strcmp(argv[0], "coproc") == 0) { // starts a coprocess
+    do_coproc(argv);
+    return 1;
+  }
+  if (strcmp(argv[0], "cosend") == 0) { // writes lines to a coprocess
+    do_cosend(argv);
+    return 1;
+  }
+  if (strcmp(argv[0], "coread") == 0) { // prints lines from a coprocess
+    do_coread(argv);
+    return 1;
+  }
+  if (strcmp(argv[0], "coclose") == 0) { // ends a coprocess's input
+    do_coclose(argv);
+    return 1;
+  }
+  if (strcmp(argv[0], "pipesize") == 0) { // shows or sets the pipe size
+    if (argv[1] == NULL) {
+      printf("%ld\n", pipesz);
+    } else if (parsesize(argv[1]) < 0) {
+      printf("pipesize: %s: Bad size\n", argv[1]);
+      builtin_status = 1;
+    } else {
+      pipesz = parsesize(argv[1]);
+    }
+    return 1;
+  }
   if (!strcmp(argv[0], "&")) {
     return 1; // Ignore singleton &
   }
@@ -409,158 +1185,626 @@ int builtin_cmd(char **argv) {
  */
 void do_bgfg(char **argv) {
   struct job_t *job;
-  int jid;
   pid_t pid;
+  sigset_t mask, prev;
 
+  builtin_status = 1;
   if (argv[1] == NULL) { // Check if argument has jobid
     printf("%s Command needs a PID or %%jobid\n", argv[0]);
     return;
   }
-  if (argv[1][0] == '%') {   // job id
-    jid = atoi(&argv[1][1]); // extract job
-    job = getjobjid(jobs, jid);
-    if (job == NULL) { // check if job exists
-      printf("%s: No such job\n", argv[1]);
-      return;
-    }
-  } else {               // pid
-    pid = atoi(argv[1]); // extract job
-    job = getjobpid(jobs, pid);
-    if (job == NULL) { // check if job exists
-      printf("%s: No such job\n", argv[1]);
-      return;
-    }
+  if ((job = getjobarg(argv[1])) == NULL) { // check if job exists
+    printf("%s: No such job\n", argv[1]);
+    return;
   }
 
   pid = job->pid; // make pid for sure
 
-  if (strcmp(argv[0], "bg")) { // change to background
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev); // the handler also changes job state
+  if (strcmp(argv[0], "bg") == 0) { // change to background
     job->state = BG;
+    publishjob(job);
     kill(-pid, SIGCONT);
-    printf("[%d] (%d) %s\n", job->jid, job->pid, job->cmdline);
+    printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+    builtin_status = 0;
   } else { // change to foreground
     job->state = FG;
+    publishjob(job);
+    givetty(job); // before it runs, or it stops again on a read
     kill(-pid, SIGCONT);
-    waitfg(pid);
   }
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  if (strcmp(argv[0], "fg") == 0)
+    builtin_status = waitfg(pid);
   return;
 }
 
 /*
- * waitfg - Block until process pid is no longer the foreground process
+ * do_wait - Execute the builtin wait command
+ *    wait            wait for every running background job
+ *    wait %N|pid...  wait for each job in turn, status of the last one
+ *    wait -n         wait for the next job to finish, return its status
+ * The shell sleeps in sigsuspend until SIGCHLD changes the job list.
+ * A ctrl-c abandons the wait with status 130.
  */
-void waitfg(pid_t pid) {
-  struct job_t *job = getjobpid(jobs, pid);
-
-  while (job != NULL && job->state == FG) {
-    usleep(1000);               // sleep to not take over the cpu
-    job = getjobpid(jobs, pid); // check if job is still in FG state
+void do_wait(char **argv) {
+  struct job_t *job;
+  struct done_t *d;
+  sigset_t mask, prev;
+  pid_t pid;
+  int i, n, running;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGINT); // only notice ctrl-c inside sigsuspend
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  interrupted = 0;
+  builtin_status = 0;
+
+  if (argv[1] == NULL) { // every running job
+    while (!interrupted) {
+      running = 0;
+      for (i = 0; i < MAXJOBS; i++)
+        running |= jobs[i].state == BG;
+      if (!running)
+        break;
+      sigsuspend(&prev);
+    }
+  } else if (strcmp(argv[1], "-n") == 0) { // whichever job finishes next
+    running = 0;
+    for (i = 0; i < MAXJOBS; i++)
+      running |= jobs[i].state == BG;
+    if (!running) {
+      builtin_status = 127;
+    } else {
+      n = ndone;
+      while (ndone == n && !interrupted)
+        sigsuspend(&prev);
+      if (ndone != n)
+        builtin_status = exitcode(done[n % MAXJOBS].status);
+    }
+  } else { // the listed jobs, in order
+    for (i = 1; argv[i] != NULL && !interrupted; i++) {
+      if ((job = getjobarg(argv[i])) != NULL) {
+        pid = job->pid;
+        while (getjobpid(jobs, pid) != NULL && !interrupted)
+          sigsuspend(&prev);
+      } else if (argv[i][0] != '%' && (d = getdonepid(atoi(argv[i])))) {
+        pid = d->pid; // already finished
+      } else {
+        printf("%s: No such job\n", argv[i]);
+        builtin_status = 127;
+        continue;
+      }
+      if ((d = getdonepid(pid)) != NULL)
+        builtin_status = exitcode(d->status);
+    }
   }
-  return;
-}
 
-/*****************
- * Signal handlers
- *****************/
+  if (interrupted)
+    builtin_status = 128 + SIGINT;
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+}
 
 /*
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.
+ * do_export - Execute the builtin export and unset commands
+ *    export               list the environment
+ *    export NAME=value..  set variables for the shell and its children
+ *    unset NAME...        remove variables
  */
-void sigchld_handler(int sig) {
-  int newerrno = errno; /* Save errno to restore later */
-  pid_t pid;
-  int status;
-
-  /* Reap all available zombie children
-   * WNOHANG: Don't block if no child has exited
-   * WUNTRACED: Also return if a child has stopped
-   */
-  while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-    struct job_t *job = getjobpid(jobs, pid);
-    if (!job) { // code should not get here
-      continue;
-    }
+void do_export(char **argv) {
+  char **ep;
+  int i;
 
-    // child terminated normally
-    if (WIFEXITED(status)) {
-      deletejob(jobs, pid); // remove job and proccess id
-    }
-    // child terminated by signal
-    else if (WIFSIGNALED(status)) {
-      printf("Job [%d] (%d) terminated by signal %d\n", job->jid, pid,
-             WTERMSIG(status));
-      deletejob(jobs, pid); // remove job and proccess id
-    }
-    // child stopped
-    else if (WIFSTOPPED(status)) {
-      printf("Job [%d] (%d) stopped by signal %d\n", job->jid, pid,
-             WSTOPSIG(status));
-      job->state = ST; // update job state to stopped
-    }
+  builtin_status = 0;
+  if (strcmp(argv[0], "export") == 0 && argv[1] == NULL) {
+    for (ep = environ; *ep != NULL; ep++)
+      printf("%s\n", *ep);
+    return;
   }
-  // no children to reap
-  if (pid < 0 && errno != ECHILD) {
-    unix_error("waitpid error");
+  for (i = 1; argv[i] != NULL; i++) {
+    if (nassign(&argv[i]) > 0 && strcmp(argv[0], "export") == 0) {
+      setvar(argv[i]);
+    } else if (!isalpha(argv[i][0]) && argv[i][0] != '_') {
+      printf("%s: %s: Bad variable name\n", argv[0], argv[i]);
+      builtin_status = 1;
+    } else if (strcmp(argv[0], "unset") == 0) {
+      unsetenv(argv[i]);
+      envdirty = 1;
+    } else if (getenv(argv[i]) == NULL) { // bare NAME: export it empty
+      setenv(argv[i], "", 0);
+      envdirty = 1;
+    }
   }
-
-  errno = newerrno; /* Restore errno */
-  return;
 }
+
 /*
- * sigint_handler - The kernel sends a SIGINT to the shell whenver the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.
+ * do_ulimit - Execute the builtin ulimit command
+ *    ulimit              show the limits for new jobs
+ *    ulimit -opts        set them (see parselimits)
+ * "ulimit -opts cmd ..." is handled by eval_cmd and limits one job.
  */
-void sigint_handler(int sig) {
-  int olderrno = errno;
-  pid_t pid = fgpid(jobs);
+void do_ulimit(char **argv) {
+  static char *names[NLIMITS] = {"cpu time (s)", "address space",
+                                 "open files", "processes"};
+  static char opts[NLIMITS] = {'t', 'v', 'n', 'u'};
+  int i;
 
-  if (pid != 0) {
-    // sending the SIGINT to the entire foreground process group
-    kill(-pid, SIGINT);
+  builtin_status = 0;
+  if (argv[1] != NULL) {
+    if (parselimits(argv, &limits) < 0)
+      builtin_status = 1;
+    return;
   }
-  errno = olderrno;
-  return;
+  for (i = 0; i < NLIMITS; i++) {
+    printf("%-20s (-%c) ", names[i], opts[i]);
+    if (!(limits.set & (1 << i)))
+      printf("unlimited\n");
+    else
+      printf("%lu\n", (unsigned long)limits.rlim[i]);
+  }
+  printf("%-20s (-m) ", "cgroup memory.max");
+  if (limits.memmax)
+    printf("%ld\n", limits.memmax);
+  else
+    printf("max\n");
+  printf("%-20s (-c) ", "cgroup cpu.max (%)");
+  if (limits.cpupct)
+    printf("%d\n", limits.cpupct);
+  else
+    printf("max\n");
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.
+ * do_coproc - Execute the builtin coproc command
+ *    coproc NAME cmd [args...]
+ * Start cmd as a background job whose stdin and stdout are pipes to the
+ * shell, so one long-lived worker can serve many requests: cosend NAME
+ * writes to it, coread NAME reads from it, and >&NAME or <&NAME
+ * redirect a later command to it. coclose NAME closes its input.
  */
-void sigtstp_handler(int sig) {
-  int olderrno = errno;
-  pid_t pid = fgpid(jobs);
+void do_coproc(char **argv) {
+  struct coproc_t *co = NULL;
+  char cmdline[MAXLINE];
+  int to[2], from[2], i, jid;
+  sigset_t mask, prev;
+  pid_t pid;
 
-  if (pid != 0) {
-    // send STGTSP to the entire foreground process group
-    kill(-pid, SIGTSTP);
+  builtin_status = 1;
+  if (argv[1] == NULL || argv[2] == NULL) {
+    printf("coproc: usage: coproc NAME cmd [args...]\n");
+    return;
   }
-  errno = olderrno;
-
-  return;
-}
-/*********************
- * End signal handlers
- *********************/
+  if ((!isalpha(argv[1][0]) && argv[1][0] != '_') ||
+      strlen(argv[1]) >= sizeof(co->name)) {
+    printf("coproc: %s: Bad coprocess name\n", argv[1]);
+    return;
+  }
+  if ((co = getcoproc(argv[1])) != NULL) {
+    if (getjobpid(jobs, co->pid) != NULL) {
+      printf("coproc: %s: Coprocess exists\n", argv[1]);
+      return;
+    }
+    do_coclose((char *[]){"coclose", argv[1], NULL}); // reuse the name
+  }
+  for (i = 0; i < MAXCOPROC && coprocs[i].name[0] != '\0'; i++)
+    ;
+  if (i == MAXCOPROC) {
+    printf("coproc: Too many coprocesses\n");
+    return;
+  }
+  co = &coprocs[i];
 
-/***********************************************
- * Helper routines that manipulate the job list
- **********************************************/
+  cmdline[0] = '\0';
+  for (i = 0; argv[i] != NULL; i++) {
+    strncat(cmdline, argv[i], sizeof(cmdline) - strlen(cmdline) - 2);
+    strcat(cmdline, argv[i + 1] != NULL ? " " : "\n");
+  }
 
-/* clearjob - Clear the entries in a job struct */
-void clearjob(struct job_t *job) {
-  job->pid = 0;
-  job->jid = 0;
-  job->state = UNDEF;
-  job->cmdline[0] = '\0';
+  if (envdirty)
+    buildenv();
+  // our ends are close-on-exec, so no other job keeps them open
+  if (pipe2(to, O_CLOEXEC) < 0 || pipe2(from, O_CLOEXEC) < 0)
+    unix_error("pipe error");
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGINT); // pending until the child resets them
+  sigaddset(&mask, SIGTSTP);
+  sigprocmask(SIG_BLOCK, &mask, &prev); // don't reap before addjob
+  fflush(stdout);
+  if ((pid = fork()) == 0) {
+    if (!subshell)
+      setpgid(0, 0);
+    childtty(getpid(), 0);
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    setlimits(&limits);
+    dup2(to[0], STDIN_FILENO);
+    dup2(from[1], STDOUT_FILENO);
+    execcmd(argv + 2);
+  }
+  COUNT(nforked);
+  if (!subshell)
+    setpgid(pid, pid);
+  if (!addjob(jobs, pid, BG, cmdline)) {
+    dropjob(&pid, 1, 0);
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    close(to[0]);
+    close(to[1]);
+    close(from[0]);
+    close(from[1]);
+    return;
+  }
+  jid = pid2jid(pid); // before it can be reaped
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  close(to[0]);
+  close(from[1]);
+
+  strcpy(co->name, argv[1]);
+  co->pid = pid;
+  co->in = to[1];
+  co->out = from[0];
+  co->nbuf = 0;
+  printf("[%d] (%d) %s", jid, pid, cmdline);
+  builtin_status = 0;
 }
 
-/* initjobs - Initialize the job list */
+/*
+ * do_cosend - Execute the builtin cosend command
+ *    cosend NAME line...
+ * Write each argument as a line to coprocess NAME, PIPE_BUF bytes per
+ * write, so a batch of requests costs a few system calls. While we
+ * wait for room in its input, its replies are read into its buffer
+ * for coread: a worker that can't write its output stops reading
+ * input, and we would wait for each other. A ctrl-c gives up with
+ * status 130.
+ */
+void do_cosend(char **argv) {
+  struct coproc_t *co;
+  struct timespec zero = {0, 0};
+  struct pollfd pfd[2];
+  sigset_t mask, prev;
+  size_t len = 0, done = 0;
+  char *buf, *p;
+  ssize_t n;
+  int i, err = 0;
+
+  builtin_status = 1;
+  if (argv[1] == NULL) {
+    printf("cosend: usage: cosend NAME line...\n");
+    return;
+  }
+  if ((co = getcoproc(argv[1])) == NULL) {
+    printf("cosend: %s: No such coprocess\n", argv[1]);
+    return;
+  }
+  for (i = 2; argv[i] != NULL; i++)
+    len += strlen(argv[i]) + 1;
+  if ((p = buf = malloc(len + 1)) == NULL)
+    unix_error("malloc error");
+  for (i = 2; argv[i] != NULL; i++)
+    p += sprintf(p, "%s\n", argv[i]);
+
+  // a worker that has gone away is an error, not a SIGPIPE for us
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGPIPE);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  interrupted = 0;
+  pfd[0].fd = co->in;
+  pfd[0].events = POLLOUT;
+  pfd[1].fd = co->out;
+  pfd[1].events = POLLIN;
+  while (done < len) {
+    // poll is never restarted, so a ctrl-c gets us out of here
+    if (poll(pfd, 2, -1) < 0) {
+      if (errno == EINTR && !interrupted)
+        continue;
+      builtin_status = 128 + SIGINT;
+      break;
+    }
+    if (pfd[1].revents != 0 && (n = cofill(co)) <= 0 &&
+        (n == 0 || errno != EINTR))
+      pfd[1].fd = -1; // its output is closed, stop watching it
+    if (pfd[0].revents == 0)
+      continue;
+    // POLLOUT means a page is free, so this much won't block
+    n = len - done < PIPE_BUF ? len - done : PIPE_BUF;
+    if ((n = write(co->in, buf + done, n)) >= 0)
+      done += n;
+    else if (errno != EINTR) {
+      err = errno;
+      break;
+    }
+  }
+  if (err != 0) {
+    printf("cosend: %s: %s\n", argv[1], strerror(err));
+    sigtimedwait(&mask, NULL, &zero); // drop the pending SIGPIPE
+  } else if (done == len) {
+    builtin_status = 0;
+  }
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  free(buf);
+}
+
+/*
+ * do_coread - Execute the builtin coread command
+ *    coread NAME [count]
+ * Print the next count (default 1) lines written by coprocess NAME,
+ * waiting for them. Output read past the last line is kept for the
+ * next coread, so a later <&NAME doesn't see it. A line longer than
+ * the buffer is printed as it arrives and counts as one line. A ctrl-c
+ * abandons the read with status 130.
+ */
+void do_coread(char **argv) {
+  struct coproc_t *co;
+  struct pollfd pfd;
+  long count = 1;
+  size_t off = 0; // start of the lines not printed yet
+  char *nl;
+  ssize_t n;
+
+  builtin_status = 1;
+  if (argv[1] == NULL || (argv[2] != NULL && (count = atol(argv[2])) < 1)) {
+    printf("coread: usage: coread NAME [count]\n");
+    return;
+  }
+  if ((co = getcoproc(argv[1])) == NULL) {
+    printf("coread: %s: No such coprocess\n", argv[1]);
+    return;
+  }
+
+  interrupted = 0;
+  pfd.fd = co->out;
+  pfd.events = POLLIN;
+  while (count > 0) {
+    if (off < co->nbuf &&
+        (nl = memchr(co->buf + off, '\n', co->nbuf - off)) != NULL) {
+      fwrite(co->buf + off, 1, nl + 1 - (co->buf + off), stdout);
+      off = nl + 1 - co->buf;
+      count--;
+      continue;
+    }
+    co->nbuf -= off; // done with the lines before off
+    memmove(co->buf, co->buf + off, co->nbuf);
+    off = 0;
+    if (co->nbuf >= MAXLINE) { // a long line, print it as it comes
+      fwrite(co->buf, 1, co->nbuf, stdout); // counts once, at its end
+      co->nbuf = 0;
+    }
+    // poll is never restarted, so a ctrl-c gets us out of here
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR && !interrupted)
+        continue;
+      builtin_status = 128 + SIGINT;
+      return;
+    }
+    if ((n = cofill(co)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      if (co->nbuf > 0) { // last line without a newline
+        fwrite(co->buf, 1, co->nbuf, stdout);
+        putchar('\n');
+        co->nbuf = 0;
+        count--;
+      }
+      if (count > 0)
+        printf("coread: %s: End of file\n", argv[1]);
+      break;
+    }
+  }
+  co->nbuf -= off;
+  memmove(co->buf, co->buf + off, co->nbuf);
+  if (count == 0)
+    builtin_status = 0;
+}
+
+/*
+ * cofill - Read what coprocess co has written into its buffer, making
+ *    the buffer bigger if it is full. Returns what read returned.
+ */
+ssize_t cofill(struct coproc_t *co) {
+  ssize_t n;
+
+  if (co->nbuf == co->size) {
+    co->size = co->size ? 2 * co->size : MAXLINE;
+    if ((co->buf = realloc(co->buf, co->size)) == NULL)
+      unix_error("realloc error");
+  }
+  if ((n = read(co->out, co->buf + co->nbuf, co->size - co->nbuf)) > 0)
+    co->nbuf += n;
+  return n;
+}
+
+/*
+ * do_coclose - Execute the builtin coclose command
+ *    coclose NAME
+ * Close our ends of coprocess NAME's pipes, so it sees end of file on
+ * its input, and forget it. Its job finishes like any other.
+ */
+void do_coclose(char **argv) {
+  struct coproc_t *co;
+
+  builtin_status = 1;
+  if (argv[1] == NULL) {
+    printf("coclose: usage: coclose NAME\n");
+    return;
+  }
+  if ((co = getcoproc(argv[1])) == NULL) {
+    printf("coclose: %s: No such coprocess\n", argv[1]);
+    return;
+  }
+  close(co->in);
+  close(co->out);
+  co->name[0] = '\0';
+  co->nbuf = 0;
+  builtin_status = 0;
+}
+
+/*
+ * waitfg - Block until process pid is no longer the foreground process
+ *    and return the job's exit status (see exitcode). The terminal, if
+ *    the job had it, comes back to the shell (see taketty).
+ */
+int waitfg(pid_t pid) {
+  struct job_t *job;
+  sigset_t mask, prev;
+  int status;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  job = getjobpid(jobs, pid);
+  while (job != NULL && job->state == FG) {
+    sigsuspend(&prev);          // sleep until a child changes state
+    job = getjobpid(jobs, pid); // check if job is still in FG state
+  }
+  if (job != NULL) // stopped
+    status = exitcode(job->status);
+  else
+    status = exitcode(fgstatus);
+  taketty(job);
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  return status;
+}
+
+/*****************
+ * Signal handlers
+ *****************/
+
+/*
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
+ *     available zombie children, but doesn't wait for any other
+ *     currently running children to terminate.
+ */
+void sigchld_handler(int sig) {
+  int newerrno = errno; /* Save errno to restore later */
+  pid_t pid;
+  int status;
+
+  /* Reap all available zombie children
+   * WNOHANG: Don't block if no child has exited
+   * WUNTRACED: Also return if a child has stopped
+   */
+  int i, live;
+  /* A bg list runs its commands in its own process group, so stops
+   * are handled by whoever stops the list as a whole */
+  int options = subshell ? WNOHANG : WNOHANG | WUNTRACED;
+
+  while ((pid = waitpid(-1, &status, options)) > 0) {
+    struct job_t *job = getjobpid(jobs, pid);
+    if (!WIFSTOPPED(status))
+      COUNT(nreaped);
+    if (!job) { // code should not get here
+      continue;
+    }
+
+    // child stopped
+    if (WIFSTOPPED(status)) {
+      if (job->state != ST) { // report each job once
+        sio_jobmsg(job->jid, job->pid, "stopped", WSTOPSIG(status));
+        job->state = ST; // update job state to stopped
+        job->status = status;
+        publishjob(job);
+        COUNT(nstopped);
+      }
+      continue;
+    }
+
+    // the last stage of a pipeline decides the exit status
+    if (pid == job->pids[job->nproc - 1]) {
+      job->status = status;
+      // child terminated by signal
+      if (WIFSIGNALED(status))
+        sio_jobmsg(job->jid, pid, "terminated", WTERMSIG(status));
+    }
+
+    live = 0;
+    for (i = 0; i < job->nproc; i++) {
+      if (job->pids[i] == pid)
+        job->pids[i] = 0;
+      live += job->pids[i] != 0;
+    }
+    if (live > 0)
+      publishjob(job);
+    if (live == 0) { // every stage is gone
+      if (job->state == FG)
+        fgstatus = job->status;
+      done[ndone % MAXJOBS].pid = job->pid;
+      done[ndone % MAXJOBS].jid = job->jid;
+      done[ndone % MAXJOBS].status = job->status;
+      ndone++;
+      removecgroup(job->cgroup);
+      deletejob(jobs, job->pid); // remove job and proccess id
+    }
+  }
+  // no children to reap
+  if (pid < 0 && errno != ECHILD) {
+    unix_error("waitpid error");
+  }
+
+  errno = newerrno; /* Restore errno */
+  return;
+}
+/*
+ * sigint_handler - The kernel sends a SIGINT to the shell whenver the
+ *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    to the foreground job.
+ */
+void sigint_handler(int sig) {
+  int olderrno = errno;
+  pid_t pid = fgpid(jobs);
+
+  if (pid != 0) {
+    // sending the SIGINT to the entire foreground process group
+    kill(-pid, SIGINT);
+  } else {
+    interrupted = 1; // stops a wait builtin
+  }
+  errno = olderrno;
+  return;
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *     the user types ctrl-z at the keyboard. Catch it and suspend the
+ *     foreground job by sending it a SIGTSTP.
+ */
+void sigtstp_handler(int sig) {
+  int olderrno = errno;
+  pid_t pid = fgpid(jobs);
+
+  if (pid != 0) {
+    // send STGTSP to the entire foreground process group
+    kill(-pid, SIGTSTP);
+  }
+  errno = olderrno;
+
+  return;
+}
+/*********************
+ * End signal handlers
+ *********************/
+
+/***********************************************
+ * Helper routines that manipulate the job list
+ **********************************************/
+
+/* clearjob - Clear the entries in a job struct */
+void clearjob(struct job_t *job) {
+  job->pid = 0;
+  job->jid = 0;
+  job->state = UNDEF;
+  job->nproc = 0;
+  job->status = 0;
+  job->cgroup = 0;
+  job->hastmodes = 0;
+  job->cmdline[0] = '\0';
+}
+
+/* initjobs - Initialize the job list */
 void initjobs(struct job_t *jobs) {
   int i;
 
@@ -588,11 +1832,19 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) {
   for (i = 0; i < MAXJOBS; i++) {
     if (jobs[i].pid == 0) {
       jobs[i].pid = pid;
+      jobs[i].pids[0] = pid;
+      jobs[i].nproc = 1;
       jobs[i].state = state;
+      while (getjobjid(jobs, nextjid) != NULL) // wrapped onto a live job
+        nextjid = nextjid % MAXJOBS + 1;
       jobs[i].jid = nextjid++;
       if (nextjid > MAXJOBS)
         nextjid = 1;
       strcpy(jobs[i].cmdline, cmdline);
+      if (jobshm != NULL)
+        clock_gettime(CLOCK_REALTIME, &jobs[i].start);
+      publishjob(&jobs[i]);
+      COUNT(nadded);
       if (verbose) {
         printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid,
                jobs[i].cmdline);
@@ -604,6 +1856,33 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) {
   return 0;
 }
 
+/* addproc - Add another pipeline stage to a job */
+int addproc(struct job_t *job, pid_t pid) {
+  if (job == NULL || pid < 1 || job->nproc == MAXPIPE)
+    return 0;
+  job->pids[job->nproc++] = pid;
+  publishjob(job);
+  return 1;
+}
+
+/*
+ * dropjob - Kill and reap the n processes of a job that addjob had no
+ *    room for, and remove its cgroup. Called with SIGCHLD blocked, so
+ *    the handler can't reap them first.
+ */
+void dropjob(pid_t *pids, int n, int cg) {
+  int i;
+
+  if (!subshell) // the job's process group, including anything it forked
+    kill(-pids[0], SIGKILL);
+  for (i = 0; i < n; i++)
+    kill(pids[i], SIGKILL);
+  for (i = 0; i < n; i++)
+    if (waitpid(pids[i], NULL, 0) > 0)
+      COUNT(nreaped);
+  removecgroup(cg);
+}
+
 /* deletejob - Delete a job whose PID=pid from the job list */
 int deletejob(struct job_t *jobs, pid_t pid) {
   int i;
@@ -614,6 +1893,8 @@ int deletejob(struct job_t *jobs, pid_t pid) {
   for (i = 0; i < MAXJOBS; i++) {
     if (jobs[i].pid == pid) {
       clearjob(&jobs[i]);
+      publishjob(&jobs[i]);
+      COUNT(ndeleted);
       nextjid = maxjid(jobs) + 1;
       return 1;
     }
@@ -631,15 +1912,19 @@ pid_t fgpid(struct job_t *jobs) {
   return 0;
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
+/* getjobpid  - Find a job (by PID of its leader or any stage) on the job list */
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-  int i;
+  int i, j;
 
   if (pid < 1)
     return NULL;
-  for (i = 0; i < MAXJOBS; i++)
+  for (i = 0; i < MAXJOBS; i++) {
     if (jobs[i].pid == pid)
       return &jobs[i];
+    for (j = 0; j < jobs[i].nproc; j++)
+      if (jobs[i].pids[j] == pid)
+        return &jobs[i];
+  }
   return NULL;
 }
 
@@ -655,6 +1940,35 @@ struct job_t *getjobjid(struct job_t *jobs, int jid) {
   return NULL;
 }
 
+/* getjobarg - Find a job from a %jobid or PID argument */
+struct job_t *getjobarg(char *arg) {
+  if (arg[0] == '%')
+    return getjobjid(jobs, atoi(&arg[1]));
+  return getjobpid(jobs, atoi(arg));
+}
+
+/* getcoproc - Find a coprocess by name, NULL if there is none */
+struct coproc_t *getcoproc(char *name) {
+  int i;
+
+  for (i = 0; i < MAXCOPROC; i++)
+    if (coprocs[i].name[0] != '\0' && strcmp(coprocs[i].name, name) == 0)
+      return &coprocs[i];
+  return NULL;
+}
+
+/* getdonepid - Find a recently finished job (by PID), NULL if forgotten */
+struct done_t *getdonepid(pid_t pid) {
+  int i;
+
+  if (pid < 1)
+    return NULL;
+  for (i = 0; i < MAXJOBS && i < ndone; i++)
+    if (done[(ndone - 1 - i) % MAXJOBS].pid == pid)
+      return &done[(ndone - 1 - i) % MAXJOBS];
+  return NULL;
+}
+
 /* pid2jid - Map process ID to job ID */
 int pid2jid(pid_t pid) {
   int i;
@@ -689,28 +2003,933 @@ void listjobs(struct job_t *jobs) {
         printf("listjobs: Internal error: job[%d].state=%d ", i, jobs[i].state);
       }
       printf("%s", jobs[i].cmdline);
+      if (jobs[i].cgroup)
+        listcgroup(jobs[i].cgroup);
     }
   }
 }
+
+/* initshm - Create the job status segment that tshtop reads */
+void initshm(void) {
+  char name[32];
+  int fd;
+
+  if (jobshm != NULL)
+    return;
+  sprintf(name, JOBSHM_NAME, getpid());
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    unix_error("shm_open error");
+  if (ftruncate(fd, sizeof(struct jobshm_t)) < 0)
+    unix_error("ftruncate error");
+  jobshm = mmap(NULL, sizeof(struct jobshm_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+  if (jobshm == MAP_FAILED)
+    unix_error("mmap error");
+  close(fd);
+  jobshm->shell = shmpid = getpid();
+  atexit(removeshm);
+}
+
+/* removeshm - Unlink the job status segment when the shell exits */
+void removeshm(void) {
+  char name[32];
+
+  if (getpid() != shmpid) // a child that failed to exec
+    return;
+  sprintf(name, JOBSHM_NAME, shmpid);
+  shm_unlink(name);
+}
+
+/*
+ * publishjob - Copy a job into its slot of the job status segment.
+ *    Must not run concurrently with itself, so callers outside the
+ *    SIGCHLD handler keep SIGCHLD blocked.
+ */
+void publishjob(struct job_t *job) {
+  struct jobstat_t *js;
+  unsigned seq;
+  size_t len;
+
+  if (jobshm == NULL)
+    return;
+  js = &jobshm->jobs[job - jobs];
+  seq = jobshm->seq;
+  __atomic_store_n(&jobshm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  js->pid = job->pid;
+  js->jid = job->jid;
+  js->state = job->state;
+  js->nproc = job->nproc;
+  memcpy(js->pids, job->pids, job->nproc * sizeof(pid_t));
+  js->start = job->start;
+  len = strlen(job->cmdline);
+  if (len > JOBSHM_CMDLEN - 1)
+    len = JOBSHM_CMDLEN - 1;
+  memcpy(js->cmdline, job->cmdline, len);
+  js->cmdline[len] = '\0';
+
+  __atomic_store_n(&jobshm->seq, seq + 2, __ATOMIC_RELEASE);
+}
 /******************************
  * end job list helper routines
  ******************************/
 
+/*******************************************
+ * Helper routines for per-job cgroups (v2)
+ ******************************************/
+
+/*
+ * initcgroup - Find a writable cgroup v2 hierarchy and make our own
+ *    directory, tsh.<pid>, below the shell's cgroup. Job cgroups go
+ *    in there. The shell itself moves into the leaf tsh.<pid>/shell,
+ *    so that tsh.<pid> has no processes of its own and may hand the
+ *    memory and cpu controllers down to the job cgroups (cgroup v2
+ *    only lets the root do that with members). Nothing above tsh.<pid>
+ *    is changed: a controller our cgroup doesn't offer stays off, and
+ *    newcgroup refuses jobs that need it. Sets cgstate to -1 if there
+ *    is no cgroup we can use.
+ */
+void initcgroup(void) {
+  char line[MAXLINE], mnt[MAXLINE] = "", rel[MAXLINE] = "";
+  char path[MAXLINE + 32], procs[MAXLINE + 64];
+  FILE *fp;
+
+  cgstate = -1;
+  if ((fp = fopen("/proc/self/mountinfo", "r")) != NULL) {
+    while (fgets(line, sizeof(line), fp) != NULL)
+      if (strstr(line, " - cgroup2 ") &&
+          sscanf(line, "%*s %*s %*s %*s %1023s", mnt) == 1)
+        break;
+    fclose(fp);
+  }
+  if ((fp = fopen("/proc/self/cgroup", "r")) != NULL) {
+    while (fgets(line, sizeof(line), fp) != NULL)
+      if (strncmp(line, "0::", 3) == 0)
+        sscanf(line + 3, "%1023s", rel);
+    fclose(fp);
+  }
+  if (mnt[0] == '\0' || rel[0] == '\0')
+    return;
+
+  snprintf(cgorig, sizeof(cgorig), "%s%s", mnt, strcmp(rel, "/") ? rel : "");
+  if (snprintf(cgroot, sizeof(cgroot), "%s/tsh.%d", cgorig, getpid()) >=
+          (int)sizeof(cgroot) ||
+      mkdir(cgroot, 0755) < 0)
+    return;
+  snprintf(path, sizeof(path), "%s/shell", cgroot);
+  if (mkdir(path, 0755) < 0) {
+    rmdir(cgroot);
+    return;
+  }
+  snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+  if (writepath(procs, "0") < 0) {
+    rmdir(path);
+    rmdir(cgroot);
+    return;
+  }
+  cgpid = getpid();
+  atexit(removecgroot);
+  cgstate = 1;
+
+  // one at a time, either may not be offered to us
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroot);
+  writepath(path, "+memory");
+  writepath(path, "+cpu");
+}
+
+/*
+ * cgpath - Build the path of file (or of the directory itself if file
+ *    is NULL) in job cgroup cg. Safe in a signal handler.
+ */
+char *cgpath(char *buf, int cg, char *file) {
+  char *p = buf, *end = buf + MAXLINE - 1;
+
+  p = sio_cat(p, cgroot, end);
+  p = sio_cat(p, "/", end);
+  p = sio_ltoa(p, cgself, end);
+  p = sio_cat(p, ".", end);
+  p = sio_ltoa(p, cg, end);
+  if (file != NULL) {
+    p = sio_cat(p, "/", end);
+    p = sio_cat(p, file, end);
+  }
+  *p = '\0';
+  return buf;
+}
+
+/*
+ * newcgroup - Make a cgroup for a new job that has memory or cpu
+ *    limits, and write them into it. Returns its number for
+ *    joincgroup, 0 if the job needs no cgroup, or -1 if the limits
+ *    can't be applied and the job must not run.
+ */
+int newcgroup(struct limits_t *lim) {
+  char path[MAXLINE], value[64];
+
+  if (lim->memmax == 0 && lim->cpupct == 0)
+    return 0;
+  if (cgstate == 0)
+    initcgroup();
+  if (cgstate < 0) {
+    printf("ulimit: no writable cgroup v2 hierarchy, job not started\n");
+    return -1;
+  }
+  cgself = getpid();
+  if (mkdir(cgpath(path, ++ncgroups, NULL), 0755) < 0) {
+    printf("ulimit: %s: %s, job not started\n", path, strerror(errno));
+    return -1;
+  }
+  if (lim->memmax) {
+    sprintf(value, "%ld", lim->memmax);
+    if (writecg(ncgroups, "memory.max", value) < 0)
+      goto fail;
+  }
+  if (lim->cpupct) {
+    sprintf(value, "%ld 100000", lim->cpupct * 1000L);
+    if (writecg(ncgroups, "cpu.max", value) < 0)
+      goto fail;
+  }
+  return ncgroups;
+
+fail: // a job that asked for a limit doesn't run without it
+  removecgroup(ncgroups);
+  return -1;
+}
+
+/*
+ * writecg - Write value to a file of job cgroup cg, saying so if it
+ *    fails. Returns 0, or -1 on failure.
+ */
+int writecg(int cg, char *file, char *value) {
+  char path[MAXLINE];
+
+  if (writepath(cgpath(path, cg, file), value) < 0) {
+    printf("ulimit: %s: %s, job not started\n", file, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/* writepath - Write value to the file at path. Returns 0, or -1 on failure */
+int writepath(const char *path, const char *value) {
+  int fd, n;
+
+  if ((fd = open(path, O_WRONLY)) < 0)
+    return -1;
+  n = write(fd, value, strlen(value));
+  close(fd);
+  return n < 0 ? -1 : 0;
+}
+
+/* readcg - Read "key value" from a file of job cgroup cg, -1 if absent */
+long readcg(int cg, char *file, char *key) {
+  char path[MAXLINE], name[64];
+  long value, found = -1;
+  FILE *fp;
+
+  if ((fp = fopen(cgpath(path, cg, file), "r")) == NULL)
+    return -1;
+  while (fscanf(fp, "%63s %ld", name, &value) == 2)
+    if (strcmp(name, key) == 0)
+      found = value;
+  fclose(fp);
+  return found;
+}
+
+/*
+ * joincgroup - Move the calling child into job cgroup cg, so every
+ *    stage of a pipeline ends up in the same one. A child that can't
+ *    join exits with status 126 rather than run without its limits.
+ */
+void joincgroup(int cg) {
+  char path[MAXLINE];
+
+  if (cg == 0)
+    return;
+  if (writepath(cgpath(path, cg, "cgroup.procs"), "0") < 0) {
+    perror("cgroup.procs");
+    _exit(126); // not exit(), see eval
+  }
+}
+
+/*
+ * removecgroup - Remove job cgroup cg once the job is gone. Called
+ *    from sigchld_handler, so only async-signal-safe calls.
+ */
+void removecgroup(int cg) {
+  char path[MAXLINE];
+
+  if (cg != 0)
+    rmdir(cgpath(path, cg, NULL));
+}
+
+/*
+ * removecgroot - Move the shell back to the cgroup it started in and
+ *    remove our cgroup directory when the shell exits
+ */
+void removecgroot(void) {
+  char path[MAXLINE + 32];
+
+  if (getpid() != cgpid)
+    return;
+  snprintf(path, sizeof(path), "%s/cgroup.procs", cgorig);
+  writepath(path, "0");
+  snprintf(path, sizeof(path), "%s/shell", cgroot);
+  rmdir(path);
+  rmdir(cgroot);
+}
+
+/*
+ * listcgroup - Print the throttling stats of job cgroup cg for jobs
+ */
+void listcgroup(int cg) {
+  static char *stats[][2] = {{"cpu.stat", "usage_usec"},
+                             {"cpu.stat", "nr_throttled"},
+                             {"cpu.stat", "throttled_usec"},
+                             {"memory.events", "high"},
+                             {"memory.events", "max"},
+                             {"memory.events", "oom_kill"}};
+  long value;
+  int i;
+
+  printf("    cgroup %d.%d:", cgself, cg);
+  for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+    if ((value = readcg(cg, stats[i][0], stats[i][1])) >= 0)
+      printf(" %s %s=%ld", stats[i][0], stats[i][1], value);
+  printf("\n");
+}
+
 /***********************
  * Other helper routines
  ***********************/
 
+/*
+ * initterm - If stdin is a terminal, become an interactive job control
+ *    shell: wait until we are in the foreground, move to our own process
+ *    group and make it the terminal's, and save the terminal modes. Jobs
+ *    are then given the terminal while they run in the foreground, so
+ *    the kernel sends ctrl-c and ctrl-z to them directly. Otherwise
+ *    (e.g. under sdriver) the handlers forward those signals.
+ */
+void initterm(void) {
+  if (!isatty(STDIN_FILENO))
+    return;
+  while (tcgetpgrp(STDIN_FILENO) != (shellpgid = getpgrp()))
+    kill(-shellpgid, SIGTTIN); // stop until fg'd by our parent shell
+  Signal(SIGTTOU, SIG_IGN); // tcsetpgrp from the background
+  Signal(SIGTTIN, SIG_IGN);
+  if (shellpgid != getpid() && setpgid(0, 0) < 0)
+    unix_error("setpgid error");
+  shellpgid = getpid();
+  if (tcsetpgrp(STDIN_FILENO, shellpgid) < 0)
+    unix_error("tcsetpgrp error");
+  tcgetattr(STDIN_FILENO, &shelltmodes);
+  ttyfd = STDIN_FILENO;
+}
+
+/*
+ * childtty - Terminal setup in a new child of process group pgid: a
+ *    foreground child takes the terminal itself too, so it can't read
+ *    from it before the shell hands it over. Every child first gets
+ *    back the default ctrl-c and ctrl-z actions, or one typed before
+ *    its exec would go to our handlers and be lost; and it gets back
+ *    the default SIGTTOU and SIGTTIN.
+ */
+void childtty(pid_t pgid, int fg) {
+  Signal(SIGINT, SIG_DFL);
+  Signal(SIGTSTP, SIG_DFL);
+  if (ttyfd < 0)
+    return;
+  if (fg)
+    tcsetpgrp(ttyfd, pgid);
+  Signal(SIGTTOU, SIG_DFL);
+  Signal(SIGTTIN, SIG_DFL);
+}
+
+/*
+ * givetty - Make job the terminal's foreground process group, in the
+ *    terminal modes it had when it last stopped
+ */
+void givetty(struct job_t *job) {
+  if (ttyfd < 0 || job == NULL)
+    return;
+  if (job->hastmodes)
+    tcsetattr(ttyfd, TCSADRAIN, &job->tmodes);
+  tcsetpgrp(ttyfd, job->pid);
+}
+
+/*
+ * taketty - Take the terminal back from the foreground job. If the job
+ *    stopped (job is not NULL), save its modes for givetty. The shell's
+ *    modes are restored first, so they are in place once it has the
+ *    terminal.
+ */
+void taketty(struct job_t *job) {
+  if (ttyfd < 0)
+    return;
+  if (job != NULL) {
+    tcgetattr(ttyfd, &job->tmodes);
+    job->hastmodes = 1;
+  }
+  tcsetattr(ttyfd, TCSADRAIN, &shelltmodes);
+  tcsetpgrp(ttyfd, shellpgid);
+}
+
 /*
  * usage - print a help message
  */
 void usage(void) {
-  printf("Usage: shell [-hvp]\n");
+  printf("Usage: shell [-hvpm] [-P size] [-c cmdline]\n");
   printf("   -h   print this message\n");
   printf("   -v   print additional diagnostic information\n");
   printf("   -p   do not emit a command prompt\n");
+  printf("   -m   publish the job list for tshtop\n");
+  printf("   -P   pipe buffer size in bytes (K, M, G suffixes)\n");
+  printf("   -c   run cmdline, exec its last command in place, and exit\n");
   exit(1);
 }
 
+/*
+ * exitcode - Turn a wait status into a shell exit status: the exit
+ *    code, or 128 + the signal number if the job was killed or stopped
+ */
+int exitcode(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  if (WIFSTOPPED(status))
+    return 128 + WSTOPSIG(status);
+  return 0;
+}
+
+/*
+ * parsesize - Parse a byte count with an optional K, M or G suffix,
+ *    -1 if it is not one
+ */
+long parsesize(const char *arg) {
+  char *end;
+  long size = strtol(arg, &end, 10);
+
+  if (end == arg || size < 0)
+    return -1;
+  switch (toupper(*end)) {
+  case 'G':
+    size <<= 10; /* fall through */
+  case 'M':
+    size <<= 10; /* fall through */
+  case 'K':
+    size <<= 10;
+    end++;
+  }
+  return *end == '\0' ? size : -1;
+}
+
+/*
+ * setpipesz - Grow (or shrink) a pipe's buffer to size bytes with
+ *    F_SETPIPE_SZ, clamped to /proc/sys/fs/pipe-max-size. A size of 0
+ *    keeps the kernel default. Failure is not fatal: the pipe just
+ *    keeps its old size.
+ */
+void setpipesz(int fd, long size) {
+  static long max = 0;
+  FILE *fp;
+
+  if (size <= 0)
+    return;
+  if (max == 0) {
+    max = 1 << 20; // kernel default for pipe-max-size
+    if ((fp = fopen("/proc/sys/fs/pipe-max-size", "r")) != NULL) {
+      if (fscanf(fp, "%ld", &max) != 1)
+        max = 1 << 20;
+      fclose(fp);
+    }
+  }
+  if (size > max)
+    size = max;
+  if (fcntl(fd, F_SETPIPE_SZ, (int)size) < 0 && verbose)
+    printf("F_SETPIPE_SZ %ld: %s\n", size, strerror(errno));
+}
+
+/*
+ * expandvars - Replace $NAME and ${NAME} in word with the variable's
+ *    value (empty if unset). Returns a copy in the line's word storage
+ *    (see argstr), or NULL if the word expanded to nothing.
+ */
+char *expandvars(const char *word) {
+  static char *buf;  // the expansion so far, grown as needed
+  static size_t size;
+  char name[MAXLINE];
+  const char *p = word, *value;
+  size_t len, n = 0;
+  int brace;
+
+  while (*p) {
+    brace = (p[0] == '$' && p[1] == '{');
+    if (*p != '$' || !(brace || isalpha(p[1]) || p[1] == '_')) {
+      value = p++;
+      len = 1;
+    } else {
+      p += brace ? 2 : 1;
+      len = 0;
+      while ((isalnum(*p) || *p == '_') && len < sizeof(name) - 1)
+        name[len++] = *p++;
+      name[len] = '\0';
+      if (brace && *p == '}')
+        p++;
+      value = getenv(name);
+      len = value ? strlen(value) : 0;
+    }
+    if (n + len + 1 > size) {
+      while (n + len + 1 > size)
+        size = size ? 2 * size : MAXLINE;
+      if ((buf = realloc(buf, size)) == NULL)
+        unix_error("realloc error");
+    }
+    memcpy(buf + n, value, len);
+    n += len;
+  }
+  if (n == 0)
+    return NULL;
+  buf[n] = '\0';
+  return argstr(buf);
+}
+
+/*
+ * addarg - Append word to args and keep it NULL terminated. A NULL
+ *    word only makes sure args has an argv.
+ */
+void addarg(struct args_t *args, char *word) {
+  if (args->argc + 2 > args->size) {
+    args->size = args->size ? 2 * args->size : 16;
+    if ((args->argv = realloc(args->argv, args->size * sizeof(char *))) == NULL)
+      unix_error("realloc error");
+  }
+  if (word != NULL)
+    args->argv[args->argc++] = word;
+  args->argv[args->argc] = NULL;
+}
+
+/*
+ * isglob - Is word a pattern, i.e. does it have a *, a ? or a [...]?
+ */
+int isglob(const char *word) {
+  const char *p;
+
+  if (strpbrk(word, "*?") != NULL)
+    return 1;
+  return (p = strchr(word, '[')) != NULL && strchr(p + 1, ']') != NULL;
+}
+
+/*
+ * globword - Append the pathnames that match pattern pat to args, in
+ *    strcmp order. Leading dots must be matched explicitly. A pattern
+ *    that matches nothing is appended as it is, as sh does.
+ */
+void globword(char *pat, struct args_t *args) {
+  char path[PATH_MAX];
+  int start = args->argc;
+
+  if (pat[0] == '/') {
+    strcpy(path, "/");
+    globdir(path, 1, pat + 1, args);
+  } else {
+    globdir(path, 0, pat, args);
+  }
+  if (args->argc == start)
+    addarg(args, pat);
+  else
+    qsort(args->argv + start, args->argc - start, sizeof(char *), cmpstr);
+}
+
+/*
+ * globdir - Append to args the pathnames below the directory in the
+ *    first len bytes of path ("" for the cwd) that match pat, one
+ *    component at a time. Only components with pattern characters
+ *    are matched against a directory listing (see readdircache).
+ */
+void globdir(char *path, size_t len, char *pat, struct args_t *args) {
+  struct dircache_t *dir;
+  struct stat sb;
+  char *slash, *name;
+  size_t n;
+  int i;
+
+  if ((slash = strchr(pat, '/')) != NULL)
+    *slash = '\0';
+  path[len] = '\0';
+  if (!isglob(pat)) { // nothing to match, just add the component
+    n = strlen(pat);
+    if (len + n + 2 < PATH_MAX) {
+      memcpy(path + len, pat, n + 1);
+      if (slash != NULL) {
+        path[len + n] = '/';
+        globdir(path, len + n + 1, slash + 1, args);
+      } else if (lstat(path, &sb) == 0) {
+        addarg(args, argstr(path));
+      }
+    }
+  } else if ((dir = readdircache(path)) != NULL) {
+    for (i = 0; i < dir->n; i++) {
+      name = dir->names + dir->name[i];
+      if (slash != NULL && dir->type[i] != DT_DIR &&
+          dir->type[i] != DT_LNK && dir->type[i] != DT_UNKNOWN)
+        continue; // can't have anything below it
+      if (fnmatch(pat, name, FNM_PERIOD) != 0)
+        continue;
+      n = strlen(name);
+      if (len + n + 2 >= PATH_MAX)
+        continue;
+      memcpy(path + len, name, n + 1);
+      if (slash != NULL) {
+        path[len + n] = '/';
+        globdir(path, len + n + 1, slash + 1, args);
+      } else {
+        addarg(args, argstr(path));
+      }
+    }
+  }
+  if (slash != NULL)
+    *slash = '/';
+}
+
+/*
+ * readdircache - Return the entries of directory path ("" for the cwd)
+ *    but "." and "..", or NULL if it can't be read. Each directory is
+ *    read once per command line, straight from getdents64 into one
+ *    buffer of names, so several patterns over a big directory only
+ *    pay for it once.
+ */
+struct dircache_t *readdircache(const char *path) {
+  static char buf[256 * 1024]; // getdents64 records
+  struct linux_dirent64 {      // not in the libc headers
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+  } *de;
+  struct dircache_t *dir;
+  size_t used = 0, size = 0, n;
+  long nread, off;
+  int fd, max = 0;
+
+  for (dir = dircache; dir != NULL; dir = dir->next)
+    if (strcmp(dir->path, path) == 0)
+      return dir->n < 0 ? NULL : dir;
+
+  if ((dir = calloc(1, sizeof(struct dircache_t))) == NULL ||
+      (dir->path = strdup(path)) == NULL)
+    unix_error("malloc error");
+  dir->next = dircache;
+  dircache = dir;
+  if ((fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+    dir->n = -1;
+    return NULL;
+  }
+  while ((nread = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+    for (off = 0; off < nread; off += de->d_reclen) {
+      de = (struct linux_dirent64 *)(buf + off);
+      if (de->d_name[0] == '.' && (de->d_name[1] == '\0' ||
+          (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+        continue;
+      n = strlen(de->d_name) + 1;
+      if (used + n > size) {
+        size = size ? 2 * size + n : 64 * 1024;
+        if ((dir->names = realloc(dir->names, size)) == NULL)
+          unix_error("realloc error");
+      }
+      if (dir->n == max) {
+        max = max ? 2 * max : 1024;
+        if ((dir->name = realloc(dir->name, max * sizeof(size_t))) == NULL ||
+            (dir->type = realloc(dir->type, max)) == NULL)
+          unix_error("realloc error");
+      }
+      memcpy(dir->names + used, de->d_name, n);
+      dir->name[dir->n] = used;
+      dir->type[dir->n++] = de->d_type;
+      used += n;
+    }
+  }
+  close(fd);
+  if (verbose)
+    printf("glob: read %s: %d entries\n", *path ? path : ".", dir->n);
+  return dir;
+}
+
+/*
+ * argstr - Copy s into the current line's word storage. Freed all at
+ *    once by globreset.
+ */
+char *argstr(const char *s) {
+  struct argblock_t *b = argblocks;
+  size_t n = strlen(s) + 1, size;
+  char *p;
+
+  if (b == NULL || b->used + n > b->size) {
+    size = n > 64 * 1024 ? n : 64 * 1024;
+    if ((b = malloc(sizeof(struct argblock_t) + size)) == NULL)
+      unix_error("malloc error");
+    b->next = argblocks;
+    b->used = 0;
+    b->size = size;
+    argblocks = b;
+  }
+  p = b->data + b->used;
+  memcpy(p, s, n);
+  b->used += n;
+  return p;
+}
+
+/*
+ * globreset - Forget the directories and words of the previous line
+ */
+void globreset(void) {
+  struct dircache_t *dir;
+  struct argblock_t *b;
+
+  while ((dir = dircache) != NULL) {
+    dircache = dir->next;
+    free(dir->path);
+    free(dir->names);
+    free(dir->name);
+    free(dir->type);
+    free(dir);
+  }
+  while ((b = argblocks) != NULL) {
+    argblocks = b->next;
+    free(b);
+  }
+}
+
+/*
+ * cmpstr - qsort comparison for an array of strings
+ */
+int cmpstr(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * nassign - Count the NAME=value words at the start of argv
+ */
+int nassign(char **argv) {
+  int n;
+  char *p;
+
+  for (n = 0; argv[n] != NULL; n++) {
+    p = argv[n];
+    if (!isalpha(*p) && *p != '_')
+      break;
+    while (isalnum(*p) || *p == '_')
+      p++;
+    if (*p != '=')
+      break;
+  }
+  return n;
+}
+
+/*
+ * setvar - Set a variable from a NAME=value word
+ */
+void setvar(char *assign) {
+  char *eq = strchr(assign, '=');
+
+  *eq = '\0';
+  setenv(assign, eq + 1, 1);
+  *eq = '=';
+  envdirty = 1;
+}
+
+/*
+ * buildenv - Rebuild envp and pathv from environ. Called by the shell
+ *    before forking whenever a variable has changed, so children can
+ *    execve with a ready-made environment and PATH list.
+ */
+void buildenv(void) {
+  static char *path = NULL;
+  char *dir, *save;
+  int i, n;
+
+  for (i = 0; i < nenvp; i++)
+    free(envp[i]);
+  for (n = 0; environ[n] != NULL; n++)
+    ;
+  if ((envp = realloc(envp, (n + 1) * sizeof(char *))) == NULL)
+    unix_error("realloc error");
+  for (i = 0; i < n; i++)
+    envp[i] = strdup(environ[i]);
+  envp[n] = NULL;
+  nenvp = n;
+
+  free(path);
+  path = strdup(getenv("PATH") ? getenv("PATH") : "/bin:/usr/bin");
+  for (n = 1, dir = path; *dir; dir++)
+    n += *dir == ':';
+  if ((pathv = realloc(pathv, (n + 1) * sizeof(char *))) == NULL)
+    unix_error("realloc error");
+  for (i = 0, dir = path; (save = strchr(dir, ':')) != NULL; dir = save + 1) {
+    *save = '\0';
+    pathv[i++] = *dir ? dir : "."; // an empty entry means the cwd
+  }
+  pathv[i++] = *dir ? dir : ".";
+  pathv[i] = NULL;
+  envdirty = 0;
+}
+
+/*
+ * execcmd - Exec argv in a child process with envp. Leading NAME=value
+ *    words go into this command's environment only. A command without
+ *    a '/' is searched for in pathv, and a file that is neither a binary
+ *    nor a #! script is run by /bin/sh (see tryexec). Never returns:
+ *    exits with status 127 if the command could not be run.
+ */
+void execcmd(char **argv) {
+  char **env = envp, path[MAXLINE];
+  int i, j, k, n, err = ENOENT;
+  size_t len;
+
+  if ((n = nassign(argv)) > 0) { // private copy with the assignments
+    env = malloc((nenvp + n + 1) * sizeof(char *));
+    for (i = j = 0; i < nenvp; i++) {
+      len = strcspn(envp[i], "=") + 1; // compare "NAME="
+      for (k = 0; k < n && strncmp(argv[k], envp[i], len) != 0; k++)
+        ;
+      if (k == n) // not overridden
+        env[j++] = envp[i];
+    }
+    for (i = 0; i < n; i++)
+      env[j++] = argv[i];
+    env[j] = NULL;
+    argv += n;
+  }
+
+  if (strchr(argv[0], '/') != NULL) {
+    tryexec(argv[0], argv, env);
+    err = errno;
+  } else {
+    for (i = 0; pathv[i] != NULL; i++) {
+      snprintf(path, sizeof(path), "%s/%s", pathv[i], argv[0]);
+      tryexec(path, argv, env);
+      if (errno != ENOENT && errno != ENOTDIR)
+        err = errno; // e.g. EACCES, report it rather than ENOENT
+    }
+  }
+  errno = err;
+  perror(argv[0]);
+  _exit(127); // not exit(), see eval
+}
+
+/*
+ * tryexec - execve path, or run it with /bin/sh if the kernel can't
+ *    (ENOEXEC), as execvp does. Returns only on failure.
+ */
+void tryexec(char *path, char **argv, char **env) {
+  char **shargv;
+  int n;
+
+  execve(path, argv, env);
+  if (errno != ENOEXEC)
+    return;
+  for (n = 0; argv[n] != NULL; n++)
+    ;
+  if ((shargv = malloc((n + 2) * sizeof(char *))) == NULL)
+    return;
+  shargv[0] = "sh";
+  shargv[1] = path;
+  memcpy(shargv + 2, argv + 1, n * sizeof(char *)); // with the NULL
+  execve("/bin/sh", shargv, env);
+  free(shargv);
+  errno = ENOEXEC;
+}
+
+/*
+ * canexec - Can a -c line's last command replace the shell? Only if
+ *    there is nothing to clean up after it: no job cgroup (lim) or
+ *    cgroup root, and no job status segment.
+ */
+int canexec(struct limits_t *lim) {
+  return jobshm == NULL && cgstate <= 0 && lim->memmax == 0 &&
+         lim->cpupct == 0;
+}
+
+/*
+ * shiftargs - Drop the first n words of a NULL terminated argv
+ */
+void shiftargs(char **argv, int n) {
+  int i;
+
+  for (i = 0; (argv[i] = argv[i + n]) != NULL; i++)
+    ;
+}
+
+/*
+ * parselimits - Parse ulimit options, from argv[1] on, into lim:
+ *    -t secs  -v bytes  -n files  -u procs   setrlimit in the child
+ *    -m bytes  -c percent                    cgroup memory.max/cpu.max
+ *    Sizes take K, M and G suffixes. "unlimited" drops the limit, so
+ *    the job just inherits the shell's own.
+ *    Returns the index of the first word after the options, or -1
+ *    (after printing why) if one is bad.
+ */
+int parselimits(char **argv, struct limits_t *lim) {
+  static char opts[] = "tvnumc"; // first NLIMITS are setrlimit ones
+  char *opt;
+  long v;
+  int i, k;
+
+  for (i = 1; argv[i] != NULL && argv[i][0] == '-'; i += 2) {
+    if (argv[i][1] == '\0' || argv[i][2] != '\0' ||
+        (opt = strchr(opts, argv[i][1])) == NULL) {
+      printf("ulimit: %s: Bad option\n", argv[i]);
+      return -1;
+    }
+    if (argv[i + 1] == NULL) {
+      printf("ulimit: %s: Needs a value\n", argv[i]);
+      return -1;
+    }
+    if (strcmp(argv[i + 1], "unlimited") == 0) {
+      v = -1;
+    } else if ((v = parsesize(argv[i + 1])) < 0) {
+      printf("ulimit: %s: Bad value\n", argv[i + 1]);
+      return -1;
+    }
+    k = opt - opts;
+    if (k < NLIMITS && v < 0) {
+      lim->set &= ~(1 << k);
+    } else if (k < NLIMITS) {
+      lim->rlim[k] = v;
+      lim->set |= 1 << k;
+    } else if (*opt == 'm') {
+      lim->memmax = (v < 0) ? 0 : v;
+    } else {
+      lim->cpupct = (v < 0) ? 0 : v;
+    }
+  }
+  return i;
+}
+
+/*
+ * setlimits - Apply the setrlimit part of lim. Runs in the child
+ *    between fork and exec, so the shell keeps its own limits.
+ */
+void setlimits(struct limits_t *lim) {
+  static int resources[NLIMITS] = {RLIMIT_CPU, RLIMIT_AS, RLIMIT_NOFILE,
+                                   RLIMIT_NPROC};
+  struct rlimit rl;
+  int i;
+
+  for (i = 0; i < NLIMITS; i++) {
+    if (!(lim->set & (1 << i)))
+      continue;
+    rl.rlim_cur = rl.rlim_max = lim->rlim[i];
+    if (i == LIM_CPU) // SIGXCPU a second before the SIGKILL
+      rl.rlim_max++;
+    if (setrlimit(resources[i], &rl) < 0)
+      perror("setrlimit");
+  }
+}
+
 /*
  * unix_error - unix-style error routine
  */
@@ -742,6 +2961,56 @@ handler_t *Signal(int signum, handler_t *handler) {
   return (old_action.sa_handler);
 }
 
+/*
+ * sio_cat - Append src to dst without passing end, return the new end.
+ *    Like the other sio_ routines it is safe in a signal handler.
+ */
+char *sio_cat(char *dst, const char *src, char *end) {
+  while (*src && dst < end)
+    *dst++ = *src++;
+  return dst;
+}
+
+/*
+ * sio_ltoa - Append the decimal form of v to dst, return the new end
+ */
+char *sio_ltoa(char *dst, long v, char *end) {
+  char digits[24];
+  int n = 0;
+
+  if (v < 0 && dst < end) {
+    *dst++ = '-';
+    v = -v;
+  }
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v > 0);
+  while (n > 0 && dst < end)
+    *dst++ = digits[--n];
+  return dst;
+}
+
+/*
+ * sio_jobmsg - Print "Job [jid] (pid) <what> by signal <sig>" with a
+ *    single write, so sigchld_handler never touches the stdio lock
+ *    that the interrupted code may be holding
+ */
+void sio_jobmsg(int jid, pid_t pid, char *what, int sig) {
+  char buf[128], *p = buf, *end = buf + sizeof(buf);
+
+  p = sio_cat(p, "Job [", end);
+  p = sio_ltoa(p, jid, end);
+  p = sio_cat(p, "] (", end);
+  p = sio_ltoa(p, pid, end);
+  p = sio_cat(p, ") ", end);
+  p = sio_cat(p, what, end);
+  p = sio_cat(p, " by signal ", end);
+  p = sio_ltoa(p, sig, end);
+  p = sio_cat(p, "\n", end);
+  write(STDOUT_FILENO, buf, p - buf);
+}
+
 /*
  * sigquit_handler - The driver program can gracefully terminate the
  *    child shell by sending it a SIGQUIT signal.
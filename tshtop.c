@@ -0,0 +1,209 @@
+/*
+ * tshtop - Live view of the jobs of a running tsh
+ *
+ * usage: tshtop [-d secs] [-n count] [pid]
+ * Maps the job status segment of the tsh with PID <pid> (started with
+ * -m; the first one found in /dev/shm if <pid> is omitted) read-only
+ * and redraws its job list every <secs> seconds (default 1), <count>
+ * times (default forever). CPU time is read from /proc for each live
+ * stage, so the shell itself never does any work for us.
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "jobshm.h"
+
+/* Job states, as in tsh.c */
+#define FG 1
+#define BG 2
+#define ST 3
+
+void usage(void);
+pid_t findshell(void);
+void snapshot(const struct jobshm_t *shm, struct jobshm_t *copy);
+double cputime(pid_t pid);
+void show(const struct jobshm_t *copy);
+
+int main(int argc, char **argv) {
+  struct jobshm_t *shm, copy;
+  double delay = 1.0;
+  long count = -1;
+  char name[32];
+  pid_t pid;
+  int c, fd;
+
+  while ((c = getopt(argc, argv, "hd:n:")) != EOF) {
+    switch (c) {
+    case 'd': /* refresh interval */
+      delay = atof(optarg);
+      break;
+    case 'n': /* number of refreshes */
+      count = atol(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  pid = (optind < argc) ? atoi(argv[optind]) : findshell();
+  if (pid <= 0) {
+    fprintf(stderr, "tshtop: no tsh -m is running\n");
+    exit(1);
+  }
+
+  sprintf(name, JOBSHM_NAME, pid);
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+    perror(name);
+    exit(1);
+  }
+  shm = mmap(NULL, sizeof(struct jobshm_t), PROT_READ, MAP_SHARED, fd, 0);
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  close(fd);
+
+  while (count != 0) {
+    if (kill(pid, 0) < 0) {
+      printf("tsh (%d) has exited\n", pid);
+      exit(0);
+    }
+    snapshot(shm, &copy);
+    show(&copy);
+    if (count > 0 && --count == 0)
+      break;
+    usleep((useconds_t)(delay * 1000000));
+  }
+  exit(0);
+}
+
+/*
+ * usage - print a help message
+ */
+void usage(void) {
+  printf("Usage: tshtop [-h] [-d secs] [-n count] [pid]\n");
+  printf("   -h        print this message\n");
+  printf("   -d secs   refresh every secs seconds (default 1)\n");
+  printf("   -n count  exit after count refreshes\n");
+  exit(1);
+}
+
+/*
+ * findshell - Return the PID of the first tsh segment in /dev/shm, 0 if
+ *    there is none
+ */
+pid_t findshell(void) {
+  DIR *dir;
+  struct dirent *de;
+  pid_t pid = 0;
+
+  if ((dir = opendir("/dev/shm")) == NULL)
+    return 0;
+  while (pid == 0 && (de = readdir(dir)) != NULL)
+    if (strncmp(de->d_name, "tsh.", 4) == 0)
+      pid = atoi(de->d_name + 4);
+  closedir(dir);
+  return pid;
+}
+
+/*
+ * snapshot - Take a consistent copy of the segment. Retries while the
+ *    shell is in the middle of an update; never blocks the shell.
+ */
+void snapshot(const struct jobshm_t *shm, struct jobshm_t *copy) {
+  unsigned before, after;
+
+  do {
+    before = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+    if (before & 1)
+      continue; // writer active
+    memcpy(copy, shm, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+  } while ((before & 1) || before != after);
+}
+
+/*
+ * cputime - User plus system CPU seconds used so far by process pid,
+ *    from /proc/<pid>/stat. 0 if the process is gone.
+ */
+double cputime(pid_t pid) {
+  char path[64], buf[1024], *p;
+  unsigned long utime, stime;
+  FILE *fp;
+  int n;
+
+  sprintf(path, "/proc/%d/stat", pid);
+  if ((fp = fopen(path, "r")) == NULL)
+    return 0;
+  n = fread(buf, 1, sizeof(buf) - 1, fp);
+  fclose(fp);
+  buf[n > 0 ? n : 0] = '\0';
+  /* skip "pid (comm)", comm may contain spaces */
+  if ((p = strrchr(buf, ')')) == NULL)
+    return 0;
+  if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &utime, &stime) != 2)
+    return 0;
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/*
+ * show - Print one frame of the job table
+ */
+void show(const struct jobshm_t *copy) {
+  const struct jobstat_t *js;
+  struct timespec now;
+  double cpu;
+  int i, j, live, njobs = 0;
+  char *state;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (isatty(STDOUT_FILENO))
+    printf("\033[H\033[J"); // clear the screen
+  for (i = 0; i < JOBSHM_MAXJOBS; i++)
+    njobs += copy->jobs[i].pid != 0;
+  printf("tsh (%d): %d job%s\n", copy->shell, njobs, njobs == 1 ? "" : "s");
+  printf("%4s %7s %-10s %5s %9s %8s  %s\n", "JID", "PID", "STATE", "PROCS",
+         "ELAPSED", "CPU", "COMMAND");
+
+  for (i = 0; i < JOBSHM_MAXJOBS; i++) {
+    js = &copy->jobs[i];
+    if (js->pid == 0)
+      continue;
+    switch (js->state) {
+    case FG:
+      state = "Foreground";
+      break;
+    case BG:
+      state = "Running";
+      break;
+    case ST:
+      state = "Stopped";
+      break;
+    default:
+      state = "?";
+    }
+    live = 0;
+    cpu = 0;
+    for (j = 0; j < js->nproc && j < JOBSHM_MAXPROC; j++) {
+      if (js->pids[j] != 0) {
+        live++;
+        cpu += cputime(js->pids[j]);
+      }
+    }
+    printf("%4d %7d %-10s %2d/%-2d %8.1fs %7.2fs  %.*s\n", js->jid, js->pid,
+           state, live, js->nproc,
+           (now.tv_sec - js->start.tv_sec) +
+               (now.tv_nsec - js->start.tv_nsec) / 1e9,
+           cpu, (int)strcspn(js->cmdline, "\n"), js->cmdline);
+  }
+  if (!isatty(STDOUT_FILENO))
+    printf("\n");
+  fflush(stdout);
+}